@@ -1,57 +1,877 @@
 #ifndef _BG_ARENA_C
 #define _BG_ARENA_C
 
+#include <fcntl.h>
+#include <stdatomic.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
-typedef unsigned int u32;
-typedef int          i32;
-typedef double       f64;
+typedef unsigned int       u32;
+typedef unsigned long long u64;
+typedef int                i32;
+typedef long long          i64;
+typedef double             f64;
+
+/*
+ * Building with -DARENA_STATS makes every arena count what is asked of it,
+ * for print_arena_stats(). Without it the counters and every update to them
+ * compile out.
+ */
+#ifdef ARENA_STATS
+#define ARENA_STATS_SIZE_CLASSES 48
+
+typedef struct ArenaStats {
+  // bytes callers asked for, alignment padding excluded
+  u64 requested;
+  u64 allocations;
+  // highest idx reached, per block for thread arenas
+  u64 peak_idx;
+  u64 alignment_waste;
+  // dynamic arrays copied away from and block tails given up on refill
+  u64 abandoned;
+  // allocations by size, [2^i, 2^(i+1)) bytes, 0 counting with 1
+  u64 size_classes[ARENA_STATS_SIZE_CLASSES];
+} ArenaStats;
+#endif
 
 typedef struct SimpleArena {
   void* buf;
-  u32   size;
-  u32   idx;
+  u64   size;
+  u64   idx;
+  // bytes from buf on that can be written, size unless virtual
+  u64   committed;
+  // ArenaFlag bits it was created with
+  u32   flags;
+  // thread arenas only, where further blocks come from
+  struct ArenaSupplier* supplier;
+#ifdef ARENA_STATS
+  ArenaStats stats;
+#endif
 } SimpleArena;
 
 enum ArenaErrorType {
   NO_ERR_ARENA_ERR_TYPE = 0,
   NULL_POINTER_ARENA_ERR_TYPE,
   SIZE_EXCEEDED_ARENA_ERR_TYPE,
+  FILE_IO_ARENA_ERR_TYPE,
+  INVALID_SNAPSHOT_ARENA_ERR_TYPE,
+  COMMIT_FAILED_ARENA_ERR_TYPE,
+  INVALID_ALIGNMENT_ARENA_ERR_TYPE,
 };
 
-SimpleArena* init_arena(const u32 size, i32* err) {
-  const u32 struct_size = sizeof(SimpleArena);
-  const u32 total_size  = struct_size + size;
+/*
+ * alloc_arena() aligns every block to ARENA_DEFAULT_ALIGN, enough for any
+ * scalar. Columns for vector loads and per-thread slots that must not share
+ * a cache line ask for ARENA_CACHE_LINE through alloc_arena_aligned().
+ */
+#define ARENA_DEFAULT_ALIGN 16
+#define ARENA_CACHE_LINE 64
 
-  void* buf = malloc(total_size);
+/*
+ * Room for the SimpleArena in front of its buffer, whole cache lines so buf
+ * starts on one. Alignment of idx is then alignment of the address, up to
+ * ARENA_CACHE_LINE, and survives a snapshot being mapped back elsewhere.
+ */
+#define ARENA_HEADER_SIZE                                            \
+  ((sizeof(SimpleArena) + ARENA_CACHE_LINE - 1) / ARENA_CACHE_LINE * \
+   ARENA_CACHE_LINE)
+
+#ifdef ARENA_STATS
+static inline void arena_stats_alloc(SimpleArena* arena, const u64 size,
+                                     const u64 pad) {
+  ArenaStats* stats      = &arena->stats;
+  u32         size_class = 0;
+  while (size >> (size_class + 1) &&
+         size_class + 1 < ARENA_STATS_SIZE_CLASSES) {
+    size_class++;
+  }
+  stats->requested += size;
+  stats->allocations++;
+  stats->alignment_waste += pad;
+  stats->size_classes[size_class]++;
+  if (arena->idx > stats->peak_idx) {
+    stats->peak_idx = arena->idx;
+  }
+}
+
+/*
+ * An allocation extended in place: more bytes, but still one allocation in
+ * the size class it started in.
+ */
+static inline void arena_stats_grow(SimpleArena* arena, const u64 bytes) {
+  arena->stats.requested += bytes;
+  if (arena->idx > arena->stats.peak_idx) {
+    arena->stats.peak_idx = arena->idx;
+  }
+}
+
+#define ARENA_STATS_INIT(arena) ((arena)->stats = (ArenaStats){0})
+#define ARENA_STATS_ALLOC(arena, size, pad) \
+  arena_stats_alloc((arena), (size), (pad))
+#define ARENA_STATS_ABANDON(arena, bytes) ((arena)->stats.abandoned += (bytes))
+#define ARENA_STATS_GROW(arena, bytes) arena_stats_grow((arena), (bytes))
+#else
+#define ARENA_STATS_INIT(arena) ((void)0)
+#define ARENA_STATS_ALLOC(arena, size, pad) ((void)0)
+#define ARENA_STATS_ABANDON(arena, bytes) ((void)0)
+#define ARENA_STATS_GROW(arena, bytes) ((void)0)
+#endif
+
+/*
+ * Backing options for init_arena() and init_virtual_arena(), or-ed together.
+ *
+ * HUGE_PAGES asks for transparent huge pages with madvise(MADV_HUGEPAGE).
+ * HUGETLB maps explicit huge pages from the pool reserved in
+ * /proc/sys/vm/nr_hugepages and falls back to HUGE_PAGES when the pool is
+ * short; virtual arenas always take the fallback. PREFAULT faults every
+ * committed page in right away, so page faults happen here and not in
+ * whatever runs first on the memory.
+ */
+enum ArenaFlag {
+  HUGE_PAGES_ARENA_FLAG = 1 << 0,
+  HUGETLB_ARENA_FLAG    = 1 << 1,
+  PREFAULT_ARENA_FLAG   = 1 << 2,
+};
+
+#define ARENA_HUGE_PAGE_SIZE (2ull << 20)
+
+static void prefault_arena_range(void* start, const u64 len) {
+#ifdef MADV_POPULATE_WRITE
+  if (madvise(start, (size_t)len, MADV_POPULATE_WRITE) == 0) {
+    return;
+  }
+#endif
+  const u64 page = (u64)sysconf(_SC_PAGESIZE);
+  for (u64 offset = 0; offset < len; offset += page) {
+    ((volatile char*)start)[offset] = 0;
+  }
+}
+
+static void advise_huge_pages(void* start, const u64 len) {
+#ifdef MADV_HUGEPAGE
+  madvise(start, (size_t)len, MADV_HUGEPAGE);
+#else
+  (void)start;
+  (void)len;
+#endif
+}
+
+/*
+ * mmap only aligns to pages: over-maps by one granule and trims the mapping
+ * to total_size bytes (a multiple of granule) starting on a granule boundary.
+ */
+static char* map_aligned_range(const u64 total_size, const u64 granule,
+                               const int prot, const int map_flags) {
+  const u64 page     = (u64)sysconf(_SC_PAGESIZE);
+  const u64 map_size = total_size + (granule > page ? granule : 0);
+  char*     map      = mmap(0, (size_t)map_size, prot,
+                            MAP_PRIVATE | MAP_ANONYMOUS | map_flags, -1, 0);
+  if (map == MAP_FAILED) {
+    return 0;
+  }
+  char*     buf  = (char*)(((uintptr_t)map + granule - 1) & ~(granule - 1));
+  const u64 head = (u64)(buf - map);
+  if (head) {
+    munmap(map, (size_t)head);
+  }
+  if (map_size - head > total_size) {
+    munmap(buf + total_size, (size_t)(map_size - head - total_size));
+  }
+  return buf;
+}
+
+/*
+ * flags is a combination of ArenaFlag, 0 for plain pages faulted in on first
+ * touch. size is rounded up to whole pages, or to whole huge pages when they
+ * are asked for.
+ */
+SimpleArena* init_arena(const u64 size, const u32 flags, i32* err) {
+  const u64 struct_size = ARENA_HEADER_SIZE;
+  if (size > (u64)-1 - struct_size - 2 * ARENA_HUGE_PAGE_SIZE) {
+    *err = SIZE_EXCEEDED_ARENA_ERR_TYPE;
+    return 0;
+  }
+  const u64 page       = (u64)sysconf(_SC_PAGESIZE);
+  u64       total_size = (struct_size + size + page - 1) / page * page;
+  void*     buf        = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  if (flags & HUGETLB_ARENA_FLAG) {
+    const u64 huge_size = (total_size + ARENA_HUGE_PAGE_SIZE - 1) /
+                          ARENA_HUGE_PAGE_SIZE * ARENA_HUGE_PAGE_SIZE;
+    buf = mmap(0, (size_t)huge_size, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (buf != MAP_FAILED) {
+      total_size = huge_size;
+    }
+  }
+#endif
+  const i32 hugetlb = buf != MAP_FAILED;
+  if (!hugetlb) {
+    // a transparent huge page only backs an aligned, fully mapped 2 MB range
+    const i32 huge    = flags & (HUGE_PAGES_ARENA_FLAG | HUGETLB_ARENA_FLAG);
+    const u64 granule = huge ? ARENA_HUGE_PAGE_SIZE : page;
+    total_size        = (total_size + granule - 1) / granule * granule;
+
+    buf = map_aligned_range(total_size, granule, PROT_READ | PROT_WRITE, 0);
+    if (!buf) {
+      *err = NULL_POINTER_ARENA_ERR_TYPE;
+      return 0;
+    }
+    if (huge) {
+      advise_huge_pages(buf, total_size);
+    }
+  }
+  // after the advice, so the faults already get huge pages
+  if (flags & PREFAULT_ARENA_FLAG) {
+    prefault_arena_range(buf, total_size);
+  }
+  SimpleArena* arena = (SimpleArena*)buf;
+  arena->buf         = (void*)(buf + struct_size);
+  arena->size        = total_size - struct_size;
+  arena->idx         = 0;
+  arena->committed   = arena->size;
+  arena->flags       = flags;
+  ARENA_STATS_INIT(arena);
+  return arena;
+}
+
+/*
+ * Releases arenas from init_arena() and init_virtual_arena() alike. Thread
+ * arenas live inside their supplier and go with free_arena_supplier().
+ */
+void free_arena(SimpleArena* arena) {
+  if (arena && !arena->supplier) {
+    munmap(arena, (size_t)(ARENA_HEADER_SIZE + arena->size));
+  }
+}
+
+/*
+ * virtual arenas
+ *
+ * Reserve a range of address space up front and make it usable in
+ * ARENA_COMMIT_GRANULE steps as idx advances. Nothing ever moves, so
+ * pointers into the arena stay valid however far it grows, and reserved but
+ * untouched space costs neither memory nor swap.
+ */
+#define ARENA_DEFAULT_RESERVE (64ull << 30)
+#define ARENA_COMMIT_GRANULE (1ull << 16)
+
+/*
+ * A huge page can only back a fully committed, aligned 2 MB range.
+ */
+static u64 arena_commit_granule(const u32 flags) {
+  if (flags & (HUGE_PAGES_ARENA_FLAG | HUGETLB_ARENA_FLAG)) {
+    return ARENA_HUGE_PAGE_SIZE;
+  }
+  const u64 page = (u64)sysconf(_SC_PAGESIZE);
+  return page > ARENA_COMMIT_GRANULE ? page : ARENA_COMMIT_GRANULE;
+}
+
+/*
+ * Inaccessible range of total_size bytes (a multiple of granule) starting on
+ * a granule boundary, 0 if the address space is not there.
+ */
+static char* reserve_arena_range(const u64 total_size, const u64 granule,
+                                 const u32 flags) {
+  char* buf = map_aligned_range(total_size, granule, PROT_NONE, MAP_NORESERVE);
+  if (!buf) {
+    return 0;
+  }
+  if (flags & (HUGE_PAGES_ARENA_FLAG | HUGETLB_ARENA_FLAG)) {
+    advise_huge_pages(buf, total_size);
+  }
+  return buf;
+}
+
+/*
+ * The arena struct sits at the start of the range, which is aligned to the
+ * commit granule, so buf + committed and buf + size stay on granule
+ * boundaries. flags as for init_arena().
+ */
+SimpleArena* init_virtual_arena(const u64 reserve, const u32 flags,
+                                i32* err) {
+  const u64 granule     = arena_commit_granule(flags);
+  const u64 struct_size = ARENA_HEADER_SIZE;
+  if (reserve > (u64)-1 - struct_size - 2 * granule) {
+    *err = SIZE_EXCEEDED_ARENA_ERR_TYPE;
+    return 0;
+  }
+  const u64 total_size = (struct_size + reserve + granule - 1) / granule *
+                         granule;
+
+  char* buf = reserve_arena_range(total_size, granule, flags);
   if (!buf) {
     *err = NULL_POINTER_ARENA_ERR_TYPE;
     return 0;
   }
+  if (mprotect(buf, (size_t)granule, PROT_READ | PROT_WRITE) != 0) {
+    munmap(buf, (size_t)total_size);
+    *err = COMMIT_FAILED_ARENA_ERR_TYPE;
+    return 0;
+  }
+  if (flags & PREFAULT_ARENA_FLAG) {
+    prefault_arena_range(buf, granule);
+  }
   SimpleArena* arena = (SimpleArena*)buf;
   arena->buf         = (void*)(buf + struct_size);
-  arena->size        = size;
+  arena->size        = total_size - struct_size;
   arena->idx         = 0;
+  arena->committed   = granule - struct_size;
+  arena->flags       = flags;
+  ARENA_STATS_INIT(arena);
+  return arena;
+}
+
+/*
+ * Commits everything up to buf + end, rounded up to the next granule.
+ */
+static i32 commit_arena(SimpleArena* arena, const u64 end) {
+  const u64 granule     = arena_commit_granule(arena->flags);
+  const u64 struct_size = ARENA_HEADER_SIZE;
+  u64 target = (struct_size + end + granule - 1) / granule * granule -
+               struct_size;
+  if (target > arena->size) {
+    target = arena->size;
+  }
+  char*     start = (char*)arena->buf + arena->committed;
+  const u64 len   = target - arena->committed;
+  if (mprotect(start, (size_t)len, PROT_READ | PROT_WRITE) != 0) {
+    return COMMIT_FAILED_ARENA_ERR_TYPE;
+  }
+  if (arena->flags & PREFAULT_ARENA_FLAG) {
+    prefault_arena_range(start, len);
+  }
+  arena->committed = target;
+  return NO_ERR_ARENA_ERR_TYPE;
+}
+
+/*
+ * thread arenas
+ *
+ * One SimpleArena per worker thread, never shared, so allocating stays a
+ * plain bump of idx. When its block runs out it takes the next free blocks
+ * of a shared ArenaSupplier, claimed with a single atomic add on the
+ * supplier's cursor: no locks, and no two threads ever write to the same
+ * block. Blocks are never handed back before free_arena_supplier().
+ */
+#define ARENA_DEFAULT_BLOCK_SIZE (1ull << 20)
+
+typedef struct ArenaSupplier {
+  char* base;
+  u64   size;
+  u64   block_size;
+  // offset of the first block nobody has claimed
+  _Atomic u64 next;
+  u32         flags;
+} ArenaSupplier;
+
+/*
+ * reserve is address space as for init_virtual_arena(); block_size is
+ * rounded up to the commit granule. Release with free_arena_supplier() once
+ * every thread is done with its arena.
+ */
+ArenaSupplier* init_arena_supplier(const u64 reserve, const u64 block_size,
+                                   const u32 flags, i32* err) {
+  const u64 granule = arena_commit_granule(flags);
+  if (!block_size || reserve > (u64)-1 - granule ||
+      block_size > (u64)-1 - granule) {
+    *err = SIZE_EXCEEDED_ARENA_ERR_TYPE;
+    return 0;
+  }
+  ArenaSupplier* supplier = malloc(sizeof(ArenaSupplier));
+  if (!supplier) {
+    *err = NULL_POINTER_ARENA_ERR_TYPE;
+    return 0;
+  }
+  const u64 total_size = (reserve + granule - 1) / granule * granule;
+  supplier->base       = reserve_arena_range(total_size, granule, flags);
+  if (!supplier->base) {
+    free(supplier);
+    *err = NULL_POINTER_ARENA_ERR_TYPE;
+    return 0;
+  }
+  supplier->size       = total_size;
+  supplier->block_size = (block_size + granule - 1) / granule * granule;
+  supplier->flags      = flags;
+  atomic_init(&supplier->next, 0);
+  return supplier;
+}
+
+void free_arena_supplier(ArenaSupplier* supplier) {
+  if (supplier) {
+    munmap(supplier->base, (size_t)supplier->size);
+    free(supplier);
+  }
+}
+
+/*
+ * Claims and commits enough whole blocks for min_size bytes. Safe to call
+ * from any number of threads at once.
+ */
+static char* claim_arena_blocks(ArenaSupplier* supplier, const u64 min_size,
+                                u64* size, i32* err) {
+  const u64 blocks = min_size / supplier->block_size + 1;
+  if (blocks > supplier->size / supplier->block_size) {
+    *err = SIZE_EXCEEDED_ARENA_ERR_TYPE;
+    return 0;
+  }
+  *size            = blocks * supplier->block_size;
+  const u64 offset = atomic_fetch_add_explicit(&supplier->next, *size,
+                                               memory_order_relaxed);
+  if (offset > supplier->size - *size) {
+    *err = SIZE_EXCEEDED_ARENA_ERR_TYPE;
+    return 0;
+  }
+  char* start = supplier->base + offset;
+  if (mprotect(start, (size_t)*size, PROT_READ | PROT_WRITE) != 0) {
+    *err = COMMIT_FAILED_ARENA_ERR_TYPE;
+    return 0;
+  }
+  if (supplier->flags & PREFAULT_ARENA_FLAG) {
+    prefault_arena_range(start, *size);
+  }
+  return start;
+}
+
+/*
+ * The arena struct sits in its first block. Meant to be called by the
+ * thread that is going to use it, but any thread may.
+ */
+SimpleArena* init_thread_arena(ArenaSupplier* supplier, i32* err) {
+  if (!supplier) {
+    *err = NULL_POINTER_ARENA_ERR_TYPE;
+    return 0;
+  }
+  u64   size  = 0;
+  char* block = claim_arena_blocks(supplier, ARENA_HEADER_SIZE, &size, err);
+  if (!block) {
+    return 0;
+  }
+  SimpleArena* arena = (SimpleArena*)block;
+  *arena = (SimpleArena){.buf       = block + ARENA_HEADER_SIZE,
+                         .size      = size - ARENA_HEADER_SIZE,
+                         .committed = size - ARENA_HEADER_SIZE,
+                         .flags     = supplier->flags,
+                         .supplier  = supplier};
   return arena;
 }
 
-void free_arena(SimpleArena* arena) { free(arena); }
+/*
+ * Moves a thread arena on to fresh blocks with room for size bytes at align.
+ * The rest of the old block is given up.
+ */
+static i32 refill_arena(SimpleArena* arena, const u64 size, const u64 align) {
+  if (size > (u64)-1 - align) {
+    return SIZE_EXCEEDED_ARENA_ERR_TYPE;
+  }
+  i32   err        = NO_ERR_ARENA_ERR_TYPE;
+  u64   block_size = 0;
+  char* block =
+      claim_arena_blocks(arena->supplier, size + align, &block_size, &err);
+  if (!block) {
+    return err;
+  }
+  ARENA_STATS_ABANDON(arena, arena->size - arena->idx);
+  arena->buf       = block;
+  arena->size      = block_size;
+  arena->idx       = 0;
+  arena->committed = block_size;
+  return NO_ERR_ARENA_ERR_TYPE;
+}
 
-void* alloc_arena(SimpleArena* arena, const u32 size, i32* err) {
+/*
+ * align is any power of two, up to a page or beyond. It applies to the
+ * address, not to idx, so it holds whatever buf itself is aligned to.
+ */
+void* alloc_arena_aligned(SimpleArena* arena, const u64 size, const u64 align,
+                          i32* err) {
   if (!arena) {
     *err = NULL_POINTER_ARENA_ERR_TYPE;
     return 0;
   }
-  // TODO : > or >= ?
-  const u32 new_idx = arena->idx + size;
-  if (new_idx > arena->size) {
+  if (!align || (align & (align - 1))) {
+    *err = INVALID_ALIGNMENT_ARENA_ERR_TYPE;
+    return 0;
+  }
+  u64 pad =
+      (u64)(0 - (uintptr_t)((char*)arena->buf + arena->idx)) & (align - 1);
+  // compared against the space left, idx + size could wrap
+  if (pad > arena->size - arena->idx ||
+      size > arena->size - arena->idx - pad) {
+    const i32 refill_err = arena->supplier ? refill_arena(arena, size, align)
+                                           : SIZE_EXCEEDED_ARENA_ERR_TYPE;
+    if (refill_err) {
+      *err = refill_err;
+      return 0;
+    }
+    pad = (u64)(0 - (uintptr_t)arena->buf) & (align - 1);
+  }
+  const u64 begin = arena->idx + pad;
+  if (begin + size > arena->committed) {
+    const i32 commit_err = commit_arena(arena, begin + size);
+    if (commit_err) {
+      *err = commit_err;
+      return 0;
+    }
+  }
+  arena->idx = begin + size;
+  ARENA_STATS_ALLOC(arena, size, pad);
+  return (void*)((char*)arena->buf + begin);
+}
+
+void* alloc_arena(SimpleArena* arena, const u64 size, i32* err) {
+  return alloc_arena_aligned(arena, size, ARENA_DEFAULT_ALIGN, err);
+}
+
+/*
+ * Dumps the counters of one arena to stderr, a no-op without ARENA_STATS.
+ */
+#ifdef ARENA_STATS
+void print_arena_stats(const SimpleArena* arena, const char* label) {
+  if (!arena) {
+    return;
+  }
+  const ArenaStats* stats = &arena->stats;
+  fprintf(stderr, "Arena %s:\n", label);
+  fprintf(stderr, "  size        : %llu (%llu committed)\n", arena->size,
+          arena->committed);
+  fprintf(stderr, "  idx         : %llu (peak %llu)\n", arena->idx,
+          stats->peak_idx);
+  fprintf(stderr, "  allocations : %llu (%llu bytes requested)\n",
+          stats->allocations, stats->requested);
+  fprintf(stderr, "  alignment   : %llu bytes of padding\n",
+          stats->alignment_waste);
+  fprintf(stderr, "  abandoned   : %llu bytes\n", stats->abandoned);
+  for (u32 i = 0; i < ARENA_STATS_SIZE_CLASSES; i++) {
+    if (stats->size_classes[i]) {
+      fprintf(stderr, "  [2^%-2u, 2^%-2u) : %llu\n", i, i + 1,
+              stats->size_classes[i]);
+    }
+  }
+}
+#else
+#define print_arena_stats(arena, label) ((void)0)
+#endif
+
+/*
+ * dynamic arrays
+ *
+ * Like nob_da_append() and friends, for any struct with items, count and
+ * capacity, keeping the items in an arena. While they are the arena's most
+ * recent allocation they grow in place by advancing idx; otherwise they are
+ * copied into a block twice the size and the old block is left behind. On
+ * failure err is set, the array keeps its old capacity and appends are
+ * dropped.
+ */
+#define ARENA_DA_INIT_CAP 256
+
+/*
+ * items (old_size bytes) resized to new_size >= old_size: in place when they
+ * end at idx and the arena has room, copied otherwise.
+ */
+void* arena_grow(SimpleArena* arena, void* items, const u64 old_size,
+                 const u64 new_size, i32* err) {
+  if (!arena) {
+    *err = NULL_POINTER_ARENA_ERR_TYPE;
+    return 0;
+  }
+  const u64 growth = new_size - old_size;
+  if (items && (char*)items + old_size == (char*)arena->buf + arena->idx &&
+      growth <= arena->size - arena->idx) {
+    const u64 end = arena->idx + growth;
+    if (end > arena->committed) {
+      const i32 commit_err = commit_arena(arena, end);
+      if (commit_err) {
+        *err = commit_err;
+        return 0;
+      }
+    }
+    arena->idx = end;
+    ARENA_STATS_GROW(arena, growth);
+    return items;
+  }
+  void* result = alloc_arena(arena, new_size, err);
+  if (result && old_size) {
+    memcpy(result, items, (size_t)old_size);
+    ARENA_STATS_ABANDON(arena, old_size);
+  }
+  return result;
+}
+
+#define arena_da_reserve(arena, da, expected_capacity, err)                   \
+  do {                                                                        \
+    if ((expected_capacity) > (da)->capacity) {                               \
+      u64 da_capacity_ = (da)->capacity ? (da)->capacity : ARENA_DA_INIT_CAP; \
+      while ((expected_capacity) > da_capacity_) {                            \
+        da_capacity_ *= 2;                                                    \
+      }                                                                       \
+      void* da_items_ =                                                       \
+          arena_grow((arena), (da)->items,                                    \
+                     (da)->capacity * sizeof(*(da)->items),                   \
+                     da_capacity_ * sizeof(*(da)->items), (err));             \
+      if (da_items_) {                                                        \
+        (da)->items    = da_items_;                                           \
+        (da)->capacity = da_capacity_;                                        \
+      }                                                                       \
+    }                                                                         \
+  } while (0)
+
+#define arena_da_append(arena, da, item, err)                \
+  do {                                                       \
+    arena_da_reserve((arena), (da), (da)->count + 1, (err)); \
+    if ((da)->count < (da)->capacity) {                      \
+      (da)->items[(da)->count++] = (item);                   \
+    }                                                        \
+  } while (0)
+
+/*
+ * checkpoints
+ *
+ * Like nob_temp_save() / nob_temp_rewind(): rewinding to a checkpoint frees
+ * everything allocated after it in O(1), so per-chunk scratch space is reused
+ * instead of piling up. A virtual arena keeps its committed pages for the
+ * next round.
+ *
+ * A checkpoint is the address of the next free byte. A thread arena that has
+ * moved on to newer blocks since (always at higher addresses) restarts its
+ * current block; the blocks in between stay used up.
+ */
+static inline u64 checkpoint_arena(const SimpleArena* arena) {
+  return (u64)(uintptr_t)((char*)arena->buf + arena->idx);
+}
+
+static inline void rewind_arena(SimpleArena* arena, const u64 checkpoint) {
+  const u64 buf = (u64)(uintptr_t)arena->buf;
+  if (checkpoint < buf) {
+    arena->idx = 0;
+  } else if (checkpoint - buf < arena->idx) {
+    arena->idx = checkpoint - buf;
+  }
+}
+
+/*
+ * relocatable references
+ *
+ * A RelPtr holds the distance from the field itself to its target, 0 for
+ * none. It stays valid as long as field and target move together, e.g. both
+ * inside one arena snapshot mapped back at another address. A RelPtr cannot
+ * point at itself, and copying a struct that holds one breaks it.
+ */
+typedef i64 RelPtr;
+
+static inline void* rel_ptr_get(const RelPtr* field) {
+  return *field ? (void*)((char*)field + *field) : 0;
+}
+
+static inline void rel_ptr_set(RelPtr* field, const void* target) {
+  *field = target ? (i64)((const char*)target - (const char*)field) : 0;
+}
+
+/*
+ * Offset of ptr from the start of the arena, and back, for entry points
+ * into a snapshot.
+ */
+static inline u64 arena_offset(const SimpleArena* arena, const void* ptr) {
+  return (u64)((const char*)ptr - (const char*)arena->buf);
+}
+
+static inline void* arena_at(const SimpleArena* arena, const u64 offset) {
+  return (char*)arena->buf + offset;
+}
+
+/*
+ * snapshots
+ *
+ * The used part of an arena written to a file and mapped back read-only.
+ * Everything in it has to reference other allocations of the same arena
+ * through RelPtr; raw pointers are only valid in the process that wrote it.
+ */
+static const char ARENA_SNAPSHOT_MAGIC[8] = {'B', 'G', 'A', 'R',
+                                             'E', 'N', 'A', '1'};
+
+// 64 bytes, so the data keeps the alignment of the mapping
+typedef struct ArenaSnapshotHeader {
+  char magic[8];
+  u64  size;
+  u64  entry;
+  u64  reserved[5];
+} ArenaSnapshotHeader;
+
+_Static_assert(sizeof(ArenaSnapshotHeader) == ARENA_CACHE_LINE,
+               "snapshot data has to start on a cache line");
+
+/*
+ * entry is an arena_offset() handed back by load_arena(), e.g. the root of
+ * a tree. Return error code.
+ */
+i32 save_arena(const SimpleArena* arena, const u64 entry, const char* path) {
+  if (!arena) {
+    return NULL_POINTER_ARENA_ERR_TYPE;
+  }
+  // loaded back at a cache line, offsets only keep their alignment if buf
+  // had the same
+  if ((uintptr_t)arena->buf % ARENA_CACHE_LINE) {
+    return INVALID_ALIGNMENT_ARENA_ERR_TYPE;
+  }
+  ArenaSnapshotHeader header = {.size = arena->idx, .entry = entry};
+  memcpy(header.magic, ARENA_SNAPSHOT_MAGIC, sizeof(header.magic));
+  FILE* file = fopen(path, "wb");
+  if (!file) {
+    return FILE_IO_ARENA_ERR_TYPE;
+  }
+  const i32 ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                 fwrite(arena->buf, 1, arena->idx, file) == arena->idx;
+  return fclose(file) == 0 && ok ? NO_ERR_ARENA_ERR_TYPE
+                                 : FILE_IO_ARENA_ERR_TYPE;
+}
+
+/*
+ * Maps a snapshot read-only, nothing is parsed or copied. The arena is full,
+ * so alloc_arena() on it fails. Release with free_loaded_arena().
+ */
+SimpleArena* load_arena(const char* path, u64* entry, i32* err) {
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    *err = FILE_IO_ARENA_ERR_TYPE;
+    return 0;
+  }
+  const off_t file_size = lseek(fd, 0, SEEK_END);
+  void*       map       = file_size >= (off_t)sizeof(ArenaSnapshotHeader)
+                              ? mmap(0, (size_t)file_size, PROT_READ,
+                                     MAP_PRIVATE, fd, 0)
+                              : MAP_FAILED;
+  close(fd);
+  if (map == MAP_FAILED) {
+    *err = FILE_IO_ARENA_ERR_TYPE;
+    return 0;
+  }
+  const ArenaSnapshotHeader* header = map;
+  if (memcmp(header->magic, ARENA_SNAPSHOT_MAGIC, sizeof(header->magic)) ||
+      header->size != (u64)file_size - sizeof(*header) ||
+      header->entry >= header->size) {
+    munmap(map, (size_t)file_size);
+    *err = INVALID_SNAPSHOT_ARENA_ERR_TYPE;
+    return 0;
+  }
+  SimpleArena* arena = malloc(sizeof(SimpleArena));
+  if (!arena) {
+    munmap(map, (size_t)file_size);
+    *err = NULL_POINTER_ARENA_ERR_TYPE;
+    return 0;
+  }
+  *arena = (SimpleArena){.buf       = (char*)map + sizeof(*header),
+                         .size      = header->size,
+                         .idx       = header->size,
+                         .committed = header->size};
+  *entry = header->entry;
+  return arena;
+}
+
+void free_loaded_arena(SimpleArena* arena) {
+  if (arena) {
+    munmap((char*)arena->buf - sizeof(ArenaSnapshotHeader),
+           sizeof(ArenaSnapshotHeader) + arena->size);
+    free(arena);
+  }
+}
+
+/*
+ * pools
+ *
+ * Fixed-size objects on top of an arena that can be freed one by one. A
+ * request is rounded up to its size class, a power of two from
+ * ARENA_POOL_MIN_SIZE to ARENA_POOL_MAX_SIZE. Each class cuts its slots from
+ * slabs of its own taken from the arena, and keeps freed slots in an
+ * intrusive list threaded through their first bytes. Allocating and freeing
+ * are O(1), and the arena only grows with the peak number of live objects,
+ * not with the number ever allocated.
+ */
+#define ARENA_POOL_MIN_SIZE 16
+#define ARENA_POOL_MAX_SIZE (1u << 16)
+#define ARENA_POOL_CLASSES 13
+#define ARENA_POOL_SLAB_SIZE (1ull << 16)
+
+typedef struct PoolSlot {
+  struct PoolSlot* next;
+} PoolSlot;
+
+typedef struct PoolClass {
+  PoolSlot* free_list;
+  char*     slab;
+  u64       slab_left;
+} PoolClass;
+
+typedef struct ArenaPool {
+  SimpleArena* arena;
+  PoolClass    classes[ARENA_POOL_CLASSES];
+} ArenaPool;
+
+static inline ArenaPool init_pool(SimpleArena* arena) {
+  return (ArenaPool){.arena = arena};
+}
+
+static inline u32 pool_size_class(const u64 size) {
+  u32 size_class = 0;
+  while (((u64)ARENA_POOL_MIN_SIZE << size_class) < size) {
+    size_class++;
+  }
+  return size_class;
+}
+
+/*
+ * Slots are aligned to their class size, up to a cache line.
+ */
+void* alloc_pool(ArenaPool* pool, const u64 size, i32* err) {
+  if (!pool || !pool->arena) {
+    *err = NULL_POINTER_ARENA_ERR_TYPE;
+    return 0;
+  }
+  if (size > ARENA_POOL_MAX_SIZE) {
     *err = SIZE_EXCEEDED_ARENA_ERR_TYPE;
     return 0;
   }
-  arena->idx = new_idx;
-  return (void*)(arena->buf + new_idx);
+  const u32  size_class = pool_size_class(size);
+  const u64  slot_size  = (u64)ARENA_POOL_MIN_SIZE << size_class;
+  PoolClass* pc         = &pool->classes[size_class];
+  if (pc->free_list) {
+    PoolSlot* slot = pc->free_list;
+    pc->free_list  = slot->next;
+    return slot;
+  }
+  if (pc->slab_left < slot_size) {
+    const u64 align = slot_size < ARENA_CACHE_LINE ? slot_size
+                                                   : ARENA_CACHE_LINE;
+    const u64 slab_size =
+        slot_size > ARENA_POOL_SLAB_SIZE ? slot_size : ARENA_POOL_SLAB_SIZE;
+    pc->slab = alloc_arena_aligned(pool->arena, slab_size, align, err);
+    if (!pc->slab) {
+      return 0;
+    }
+    pc->slab_left = slab_size;
+  }
+  void* result = pc->slab;
+  pc->slab += slot_size;
+  pc->slab_left -= slot_size;
+  return result;
+}
+
+/*
+ * size has to be the size ptr was allocated with, or at least one of the
+ * same class. Freeing 0, or a size no class holds, does nothing.
+ */
+void free_pool_slot(ArenaPool* pool, void* ptr, const u64 size) {
+  if (!ptr || size > ARENA_POOL_MAX_SIZE) {
+    return;
+  }
+  PoolClass* pc   = &pool->classes[pool_size_class(size)];
+  PoolSlot*  slot = ptr;
+  slot->next      = pc->free_list;
+  pc->free_list   = slot;
 }
 
 /*
@@ -0,0 +1,98 @@
+#ifndef _BG_FORMAT_C
+#define _BG_FORMAT_C
+
+#include <math.h>
+#include <stdio.h>
+
+typedef unsigned int       u32;
+typedef unsigned long long u64;
+typedef double             f64;
+
+/*
+ * Largest magnitude format_f64_fixed6() handles itself; val * 10^6 must stay
+ * below 2^52 for the rounding below to be exact. Anything larger goes through
+ * snprintf().
+ */
+static const f64 FORMAT_FIXED6_MAX = 4503599627.0;
+
+/*
+ * Rounds val * 10^6 to the nearest integer like printf does: on the exact
+ * binary value, ties to even.
+ *
+ * p = val * 10^6 is rounded, but Dekker's two-product recovers the exact
+ * product as p + err (10^6 has 20 significant bits, so only val is split).
+ * p - nearbyint(p) is exact, and err can only change the result when that
+ * difference is exactly one half: p looked like a tie, the exact product is
+ * not one, and it lies on the side err points to.
+ */
+static inline f64 format_round_scaled6(const f64 val) {
+  const f64 scale    = 1e6;
+  const f64 p        = val * scale;
+  const f64 splitter = 134217729.0;  // 2^27 + 1
+  const f64 t        = splitter * val;
+  const f64 val_hi   = t - (t - val);
+  const f64 val_lo   = val - val_hi;
+  const f64 err      = (val_hi * scale - p) + val_lo * scale;
+
+  const f64 rounded = nearbyint(p);
+  const f64 diff    = p - rounded;
+  if (diff == 0.5 && err > 0) {
+    return rounded + 1.0;
+  }
+  if (diff == -0.5 && err < 0) {
+    return rounded - 1.0;
+  }
+  return rounded;
+}
+
+/*
+ * Writes val exactly like printf("%f", val) (6 decimals, no terminator) and
+ * returns the number of bytes written. out needs room for 24 bytes when
+ * |val| < FORMAT_FIXED6_MAX, and for 320 otherwise.
+ */
+u32 format_f64_fixed6(char* out, const f64 val) {
+  if (!(fabs(val) < FORMAT_FIXED6_MAX)) {
+    return (u32)snprintf(out, 320, "%f", val);
+  }
+
+  const f64 scaled    = format_round_scaled6(val);
+  u64       magnitude = (u64)fabs(scaled);
+  char      digits[24];
+  u32       num_digits = 0;
+  // at least "0.000000"
+  while (magnitude || num_digits < 7) {
+    digits[num_digits++] = (char)('0' + magnitude % 10);
+    magnitude /= 10;
+  }
+
+  u32 len = 0;
+  if (signbit(val)) {
+    out[len++] = '-';
+  }
+  for (u32 i = num_digits; i > 6; i--) {
+    out[len++] = digits[i - 1];
+  }
+  out[len++] = '.';
+  for (u32 i = 6; i > 0; i--) {
+    out[len++] = digits[i - 1];
+  }
+  return len;
+}
+
+/*
+ * Number of bytes format_f64_fixed6() writes for val, without writing them.
+ */
+u32 format_f64_fixed6_len(const f64 val) {
+  if (!(fabs(val) < FORMAT_FIXED6_MAX)) {
+    return (u32)snprintf(0, 0, "%f", val);
+  }
+  u64 int_part = (u64)fabs(format_round_scaled6(val)) / 1000000;
+  // sign, first integer digit, '.' and 6 decimals
+  u32 len = (signbit(val) ? 1 : 0) + 1 + 7;
+  for (; int_part >= 10; int_part /= 10) {
+    len++;
+  }
+  return len;
+}
+
+#endif  // _BG_FORMAT_C
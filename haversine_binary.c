@@ -0,0 +1,318 @@
+#ifndef _BG_HAVERSINE_BINARY_C
+#define _BG_HAVERSINE_BINARY_C
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "arena.c"
+#include "haversine_pairs.c"
+
+typedef unsigned char      u8;
+typedef unsigned int       u32;
+typedef unsigned long long u64;
+typedef int                i32;
+typedef double             f64;
+
+/*
+ * Binary columnar pairs written by haversine_gen --format bin: a 64-byte
+ * header, then the x0, y0, x1 and y1 columns as raw f64, each one starting on
+ * a 64-byte boundary. Values are in host byte order, which is little-endian
+ * on everything this builds for.
+ */
+#define HAVERSINE_BINARY_ALIGN 64
+#define HAVERSINE_BINARY_COLUMNS 4
+
+static const char HAVERSINE_BINARY_MAGIC[8] = {'H', 'A', 'V', 'P',
+                                               'A', 'I', 'R', 'S'};
+static const u32  HAVERSINE_BINARY_VERSION  = 1;
+
+typedef struct HaversineBinaryHeader {
+  char magic[8];
+  u32  version;
+  u32  header_size;
+  u64  count;
+  // distance between column starts in bytes
+  u64  column_stride;
+  // parse caches only, see haversine_write_cache()
+  u64  source_hash;
+  u64  source_mtime;
+  u8   reserved[16];
+} HaversineBinaryHeader;
+
+HaversineBinaryHeader haversine_binary_header(const u64 count) {
+  HaversineBinaryHeader header = {
+      .version       = HAVERSINE_BINARY_VERSION,
+      .header_size   = sizeof(HaversineBinaryHeader),
+      .count         = count,
+      .column_stride = (count * sizeof(f64) + HAVERSINE_BINARY_ALIGN - 1) /
+                       HAVERSINE_BINARY_ALIGN * HAVERSINE_BINARY_ALIGN,
+  };
+  memcpy(header.magic, HAVERSINE_BINARY_MAGIC, sizeof(header.magic));
+  return header;
+}
+
+/*
+ * The last column is not padded, so this is also the file size.
+ */
+static inline u64 haversine_binary_size(const HaversineBinaryHeader* header) {
+  return header->header_size +
+         (HAVERSINE_BINARY_COLUMNS - 1) * header->column_stride +
+         header->count * sizeof(f64);
+}
+
+/*
+ * Fails with PARSE_HAVERSINE_ERR_TYPE when the file is not in this format,
+ * e.g. when it is JSON.
+ */
+i32 haversine_read_binary_header(const char*            path,
+                                 HaversineBinaryHeader* header) {
+  FILE* file = fopen(path, "rb");
+  if (!file) {
+    return FILE_IO_HAVERSINE_ERR_TYPE;
+  }
+  const size_t read_len = fread(header, 1, sizeof(*header), file);
+  fseeko(file, 0, SEEK_END);
+  const u64 file_len = (u64)ftello(file);
+  fclose(file);
+  if (read_len != sizeof(*header) ||
+      memcmp(header->magic, HAVERSINE_BINARY_MAGIC, sizeof(header->magic)) ||
+      header->version != HAVERSINE_BINARY_VERSION ||
+      header->header_size < sizeof(*header) ||
+      // bounded first so neither the column nor the file size can wrap
+      header->count > (u64)-1 / sizeof(f64) ||
+      header->column_stride > file_len ||
+      header->column_stride < header->count * sizeof(f64) ||
+      file_len < haversine_binary_size(header)) {
+    return PARSE_HAVERSINE_ERR_TYPE;
+  }
+  return NO_ERR_HAVERSINE_ERR_TYPE;
+}
+
+/*
+ * A binary file mapped read-only, with pairs pointing into the mapping.
+ */
+typedef struct HaversineMappedPairs {
+  void*          map;
+  u64            size;
+  // size of the JSON source when this is a parse cache, 0 otherwise
+  u64            source_size;
+  // pairs in the file, pairs.count is only set when it fits a u32
+  u64            count;
+  HaversinePairs pairs;
+} HaversineMappedPairs;
+
+/*
+ * Maps the columns of a file of any count; the pair pointers are valid for
+ * all `count` pairs but pairs.count is left at 0, see haversine_mapped_slice().
+ * Release with haversine_unmap_pairs().
+ */
+i32 haversine_map_binary_columns(const char*           path,
+                                 HaversineMappedPairs* mapped) {
+  *mapped                      = (HaversineMappedPairs){0};
+  HaversineBinaryHeader header = {0};
+  i32 err = haversine_read_binary_header(path, &header);
+  if (err) {
+    return err;
+  }
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return FILE_IO_HAVERSINE_ERR_TYPE;
+  }
+  const u64 size = haversine_binary_size(&header);
+  void*     map  = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return FILE_IO_HAVERSINE_ERR_TYPE;
+  }
+  f64* columns = (f64*)((char*)map + header.header_size);
+  const u64 stride = header.column_stride / sizeof(f64);
+  *mapped = (HaversineMappedPairs){
+      .map   = map,
+      .size  = size,
+      .count = header.count,
+      .pairs = {.x0 = columns,
+                .y0 = columns + stride,
+                .x1 = columns + 2 * stride,
+                .y1 = columns + 3 * stride},
+  };
+  return NO_ERR_HAVERSINE_ERR_TYPE;
+}
+
+void haversine_unmap_pairs(HaversineMappedPairs* mapped) {
+  if (mapped->map) {
+    munmap(mapped->map, mapped->size);
+  }
+  *mapped = (HaversineMappedPairs){0};
+}
+
+/*
+ * Maps the columns instead of reading them: nothing is copied and computing
+ * starts on the first page fault. Files of 2^32 pairs or more fail with
+ * INVALID_INPUT_HAVERSINE_ERR_TYPE. Release with haversine_unmap_pairs().
+ */
+i32 haversine_map_binary(const char* path, HaversineMappedPairs* mapped) {
+  const i32 err = haversine_map_binary_columns(path, mapped);
+  if (err) {
+    return err;
+  }
+  if (mapped->count > (u32)-1) {
+    haversine_unmap_pairs(mapped);
+    return INVALID_INPUT_HAVERSINE_ERR_TYPE;
+  }
+  mapped->pairs.count = (u32)mapped->count;
+  return NO_ERR_HAVERSINE_ERR_TYPE;
+}
+
+/*
+ * Pairs [begin, begin + n) of a mapping, n at most mapped->count - begin.
+ * Walks files too large for one HaversinePairs.
+ */
+static inline HaversinePairs haversine_mapped_slice(
+    const HaversineMappedPairs* mapped, const u64 begin, const u32 n) {
+  return (HaversinePairs){.x0    = mapped->pairs.x0 + begin,
+                          .y0    = mapped->pairs.y0 + begin,
+                          .x1    = mapped->pairs.x1 + begin,
+                          .y1    = mapped->pairs.y1 + begin,
+                          .count = n};
+}
+
+/*
+ * Parse cache
+ *
+ * After parsing a JSON input the processor writes its columns next to it as
+ * <input>.cache in the binary format above, and maps that instead of parsing
+ * while the source is unchanged. Hashing a multi-GB source would cost as
+ * much as parsing it, so the source is fingerprinted by its size and its
+ * first and last HAVERSINE_FINGERPRINT_BLOCK bytes, together with its mtime.
+ */
+#define HAVERSINE_FINGERPRINT_BLOCK (1 << 16)
+
+static const char* HAVERSINE_CACHE_SUFFIX = ".cache";
+
+static u64 haversine_fnv1a(u64 hash, const u8* bytes, const u64 len) {
+  for (u64 i = 0; i < len; i++) {
+    hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+  }
+  return hash;
+}
+
+/*
+ * Nanosecond mtime where struct stat has one, whole seconds elsewhere.
+ */
+#if defined(__APPLE__)
+#define HAVERSINE_STAT_MTIME_NS(st)                \
+  ((u64)(st).st_mtimespec.tv_sec * 1000000000ull + \
+   (u64)(st).st_mtimespec.tv_nsec)
+#elif defined(__linux__)
+#define HAVERSINE_STAT_MTIME_NS(st) \
+  ((u64)(st).st_mtim.tv_sec * 1000000000ull + (u64)(st).st_mtim.tv_nsec)
+#else
+#define HAVERSINE_STAT_MTIME_NS(st) ((u64)(st).st_mtime * 1000000000ull)
+#endif
+
+/*
+ * Returns 0 if the source cannot be read.
+ */
+static u64 haversine_source_fingerprint(const char* path, u64* mtime,
+                                        u64* size) {
+  struct stat st = {0};
+  FILE*       file = fopen(path, "rb");
+  if (!file || fstat(fileno(file), &st) != 0) {
+    if (file) {
+      fclose(file);
+    }
+    return 0;
+  }
+  *mtime   = HAVERSINE_STAT_MTIME_NS(st);
+  *size    = (u64)st.st_size;
+  u64 hash = haversine_fnv1a(0xCBF29CE484222325ull, (const u8*)size,
+                             sizeof(*size));
+
+  u8 block[HAVERSINE_FINGERPRINT_BLOCK];
+  hash = haversine_fnv1a(hash, block, fread(block, 1, sizeof(block), file));
+  if (*size > sizeof(block)) {
+    fseeko(file, (off_t)(*size - sizeof(block)), SEEK_SET);
+    hash = haversine_fnv1a(hash, block, fread(block, 1, sizeof(block), file));
+  }
+  fclose(file);
+  return hash ? hash : 1;
+}
+
+static void haversine_cache_path(const char* source_path, char* out,
+                                 const u64 capacity) {
+  snprintf(out, capacity, "%s%s", source_path, HAVERSINE_CACHE_SUFFIX);
+}
+
+/*
+ * Maps <source_path>.cache if it was written for the source as it is now.
+ * FILE_IO_HAVERSINE_ERR_TYPE when there is none, PARSE_HAVERSINE_ERR_TYPE
+ * when it is stale.
+ */
+i32 haversine_map_cache(const char* source_path, HaversineMappedPairs* mapped) {
+  *mapped = (HaversineMappedPairs){0};
+  char cache_path[4096];
+  haversine_cache_path(source_path, cache_path, sizeof(cache_path));
+
+  HaversineBinaryHeader header = {0};
+  i32 err = haversine_read_binary_header(cache_path, &header);
+  if (err) {
+    return err;
+  }
+  u64       mtime = 0;
+  u64       size  = 0;
+  const u64 hash  = haversine_source_fingerprint(source_path, &mtime, &size);
+  if (!hash || hash != header.source_hash || mtime != header.source_mtime) {
+    return PARSE_HAVERSINE_ERR_TYPE;
+  }
+  err = haversine_map_binary(cache_path, mapped);
+  mapped->source_size = err ? 0 : size;
+  return err;
+}
+
+/*
+ * Writes to a temporary file and renames it, so a concurrent or interrupted
+ * run never sees half a cache.
+ */
+i32 haversine_write_cache(const char*           source_path,
+                          const HaversinePairs* pairs) {
+  HaversineBinaryHeader header      = haversine_binary_header(pairs->count);
+  u64                   source_size = 0;
+  header.source_hash = haversine_source_fingerprint(
+      source_path, &header.source_mtime, &source_size);
+  if (!header.source_hash) {
+    return FILE_IO_HAVERSINE_ERR_TYPE;
+  }
+  char cache_path[4096];
+  char tmp_path[4096 + 8];
+  haversine_cache_path(source_path, cache_path, sizeof(cache_path));
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", cache_path);
+
+  FILE* file = fopen(tmp_path, "wb");
+  if (!file) {
+    return FILE_IO_HAVERSINE_ERR_TYPE;
+  }
+  const f64* columns[HAVERSINE_BINARY_COLUMNS] = {pairs->x0, pairs->y0,
+                                                  pairs->x1, pairs->y1};
+  const u8   padding[HAVERSINE_BINARY_ALIGN]   = {0};
+  const u64  column_size = pairs->count * sizeof(f64);
+  i32        ok          = fwrite(&header, sizeof(header), 1, file) == 1;
+  for (u32 c = 0; ok && c < HAVERSINE_BINARY_COLUMNS; c++) {
+    ok = fwrite(columns[c], sizeof(f64), pairs->count, file) == pairs->count;
+    if (ok && c + 1 < HAVERSINE_BINARY_COLUMNS) {
+      const u64 pad = header.column_stride - column_size;
+      ok            = fwrite(padding, 1, pad, file) == pad;
+    }
+  }
+  ok = fclose(file) == 0 && ok;
+  if (!ok || rename(tmp_path, cache_path) != 0) {
+    remove(tmp_path);
+    return FILE_IO_HAVERSINE_ERR_TYPE;
+  }
+  return NO_ERR_HAVERSINE_ERR_TYPE;
+}
+
+#endif  // _BG_HAVERSINE_BINARY_C
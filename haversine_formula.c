@@ -14,6 +14,9 @@
    LISTING 65
    ======================================================================== */
 
+#ifndef _BG_HAVERSINE_FORMULA_C
+#define _BG_HAVERSINE_FORMULA_C
+
 #include <math.h>
 typedef double f64;
 
@@ -55,3 +58,5 @@ static f64 ReferenceHaversine(f64 X0, f64 Y0, f64 X1, f64 Y1, f64 EarthRadius) {
 
   return Result;
 }
+
+#endif  // _BG_HAVERSINE_FORMULA_C
@@ -1,67 +1,282 @@
 #define _CRT_SECURE_NO_WARNINGS
 
+#include <fcntl.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
+#include "format.c"
+#include "haversine_binary.c"
 #include "haversine_formula.c"
+#include "random.c"
 
 typedef unsigned int u32;
+typedef unsigned long long u64;
 typedef double f64;
 
 extern f64 ReferenceHaversine(f64 X0, f64 Y0, f64 X1, f64 Y1, f64 EarthRadius);
 extern const f64 REF_EARTH_RADIUS_KM;
 
-static const char *json_filename = "haversine_input.json";
+// the answers are the same for every format of the same seed
+enum GenFormat { GEN_FORMAT_JSON, GEN_FORMAT_NDJSON, GEN_FORMAT_BIN };
+
+static const char *format_names[] = {"json", "ndjson", "bin"};
+static const char *input_filenames[] = {
+    "haversine_input.json", "haversine_input.ndjson", "haversine_input.bin"};
 static const char *result_filename = "haversine_result.txt";
+static const char *answers_filename = "haversine_answers.f64";
+// NDJSON is just the records, binary writes a HaversineBinaryHeader
+static const char *text_headers[] = {"{\n\t\"pairs\": [\n", "", ""};
+static const char *text_footers[] = {"\t]\n}\n", "", ""};
 static const f64 haversine_x_upper = 180.0;
 static const f64 haversine_x_lower = -180.0;
 static const f64 haversine_y_upper = 90.0;
 static const f64 haversine_y_lower = -90.0;
 
-inline f64 gen_rand_float(const f64 upper, const f64 lower) {
-  // initial result from [0.0 to 1.0]
-  const f64 initial = (f64)rand() / (f64)RAND_MAX;
+// pairs are generated, summed and written in fixed chunks, so the output and
+// the floating-point sum do not depend on how many threads produced them
+#define GEN_CHUNK_PAIRS (1 << 16)
+// "\t\t{\"x0\": -180.000000, ... \"y1\": -90.000000},\n" is 79 bytes
+#define GEN_MAX_RECORD_LEN 128
+
+/*
+ * Coordinate distributions
+ *
+ * uniform   : lon and lat uniform over the whole globe
+ * cluster   : both points around random centres, Gaussian spread
+ * antipodal : end point close to the antipode of the start, asin near 1
+ * duplicate : end point up to ~1 km from the start (1e-7 to 1e-2 degrees),
+ *             often equal once rounded to the printed 6 decimals
+ * polar     : both points within 15 degrees of a pole
+ */
+enum GenDistribution {
+  GEN_DIST_UNIFORM,
+  GEN_DIST_CLUSTER,
+  GEN_DIST_ANTIPODAL,
+  GEN_DIST_DUPLICATE,
+  GEN_DIST_POLAR,
+};
+
+static const char *distribution_names[] = {"uniform", "cluster", "antipodal",
+                                           "duplicate", "polar"};
+// pair i always uses draws [k * i, k * i + k) of the stream, so any range can
+// be generated on its own
+static const u32 distribution_draws[] = {4, 6, 5, 5, 6};
+
+#define GEN_MAX_CLUSTERS 4096
+static const u32 gen_default_clusters = 16;
+// standard deviation around a cluster centre, in degrees of latitude
+static const f64 gen_cluster_sigma = 2.0;
+static const f64 gen_polar_cap = 15.0;
+static const f64 gen_pi = 3.14159265358979323846;
+
+typedef struct GenModel {
+  enum GenDistribution distribution;
+  u32 num_clusters;
+  f64 cluster_x[GEN_MAX_CLUSTERS];
+  f64 cluster_y[GEN_MAX_CLUSTERS];
+} GenModel;
+
+// snap to the 6 decimals written by "%f", so the reference answers are
+// computed on exactly the values a reader parses back
+static inline f64 gen_snap(const f64 val) { return round(val * 1e6) / 1e6; }
+
+static inline f64 gen_rand_float(RandomStream *stream, const f64 upper,
+                                 const f64 lower) {
+  // initial result from [0.0 to 1.0)
+  const f64 initial = random_next_f64(stream);
   // scale and shift
   const f64 result = (initial * fabs(upper - lower)) + lower;
-  return result;
+  return gen_snap(result);
 }
 
-int gen_write_all(u32 random_seed, u32 num_pairs) {
-  FILE *jsonfile = fopen(json_filename, "w");
-  if (jsonfile == NULL) {
-    fprintf(stderr, "Could not open file %s for writing\n", json_filename);
-    return EXIT_FAILURE;
+// two independent standard normal values (Box-Muller), two draws
+static inline void gen_rand_normal2(RandomStream *stream, f64 *a, f64 *b) {
+  const f64 radius = sqrt(-2.0 * log(1.0 - random_next_f64(stream)));
+  const f64 angle = 2.0 * gen_pi * random_next_f64(stream);
+  *a = radius * cos(angle);
+  *b = radius * sin(angle);
+}
+
+// log-uniform in [10^lo, 10^hi), one draw
+static inline f64 gen_rand_scale(RandomStream *stream, const f64 lo,
+                                 const f64 hi) {
+  return pow(10.0, lo + (hi - lo) * random_next_f64(stream));
+}
+
+static inline f64 gen_wrap_x(const f64 x) {
+  const f64 wrapped = fmod(x + 180.0, 360.0);
+  return (wrapped < 0 ? wrapped + 360.0 : wrapped) - 180.0;
+}
+
+// reflect over the pole, then clamp what is left of rounding
+static inline f64 gen_fold_y(f64 y) {
+  y = y > 90.0 ? 180.0 - y : y;
+  y = y < -90.0 ? -180.0 - y : y;
+  return fmax(haversine_y_lower, fmin(haversine_y_upper, y));
+}
+
+// three draws
+static inline void gen_rand_cluster_point(RandomStream *stream,
+                                          const GenModel *model, f64 *x,
+                                          f64 *y) {
+  const u32 c = (u32)(random_next_u64(stream) % model->num_clusters);
+  f64 dx, dy;
+  gen_rand_normal2(stream, &dx, &dy);
+  *y = gen_fold_y(model->cluster_y[c] + gen_cluster_sigma * dy);
+  // keep the spread roughly round instead of stretching towards the poles
+  const f64 cos_y = fmax(cos(*y * gen_pi / 180.0), 0.05);
+  *x = gen_snap(
+      gen_wrap_x(model->cluster_x[c] + gen_cluster_sigma * dx / cos_y));
+  *y = gen_snap(*y);
+}
+
+// three draws
+static inline void gen_rand_polar_point(RandomStream *stream, f64 *x, f64 *y) {
+  const f64 pole = random_next_f64(stream) < 0.5 ? -1.0 : 1.0;
+  const f64 depth = random_next_f64(stream);
+  *y = gen_snap(pole * (90.0 - gen_polar_cap * depth * depth));
+  *x = gen_rand_float(stream, haversine_x_upper, haversine_x_lower);
+}
+
+static inline void gen_rand_pair(RandomStream *stream, const GenModel *model,
+                                 const u64 index, f64 *x0, f64 *x1, f64 *y0,
+                                 f64 *y1) {
+  random_seek(stream, index * distribution_draws[model->distribution]);
+  switch (model->distribution) {
+  case GEN_DIST_CLUSTER:
+    gen_rand_cluster_point(stream, model, x0, y0);
+    gen_rand_cluster_point(stream, model, x1, y1);
+    break;
+  case GEN_DIST_ANTIPODAL:
+  case GEN_DIST_DUPLICATE: {
+    *x0 = gen_rand_float(stream, haversine_x_upper, haversine_x_lower);
+    *y0 = gen_rand_float(stream, haversine_y_upper, haversine_y_lower);
+    // antipodes up to a degree off, duplicates up to ~1 km apart
+    const int antipodal = model->distribution == GEN_DIST_ANTIPODAL;
+    const f64 scale = antipodal ? gen_rand_scale(stream, -6.0, 0.0)
+                                : gen_rand_scale(stream, -7.0, -2.0);
+    const f64 dx = scale * (2.0 * random_next_f64(stream) - 1.0);
+    const f64 dy = scale * (2.0 * random_next_f64(stream) - 1.0);
+    *x1 = gen_snap(gen_wrap_x(*x0 + (antipodal ? 180.0 : 0.0) + dx));
+    *y1 = gen_snap(gen_fold_y((antipodal ? -*y0 : *y0) + dy));
+    break;
+  }
+  case GEN_DIST_POLAR:
+    gen_rand_polar_point(stream, x0, y0);
+    gen_rand_polar_point(stream, x1, y1);
+    break;
+  default:
+    *x0 = gen_rand_float(stream, haversine_x_upper, haversine_x_lower);
+    *x1 = gen_rand_float(stream, haversine_x_upper, haversine_x_lower);
+    *y0 = gen_rand_float(stream, haversine_y_upper, haversine_y_lower);
+    *y1 = gen_rand_float(stream, haversine_y_upper, haversine_y_lower);
+    break;
   }
-  printf("Generating JSON output...\n");
-  srand(random_seed);
+}
 
-  f64 sum = 0;
-  fprintf(jsonfile, "{\n\t\"pairs\": [\n");
-  for (u32 i = 0; i < num_pairs - 1; i++) {
-    f64 x0 = gen_rand_float(haversine_x_upper, haversine_x_lower);
-    f64 x1 = gen_rand_float(haversine_x_upper, haversine_x_lower);
-    f64 y0 = gen_rand_float(haversine_y_upper, haversine_y_lower);
-    f64 y1 = gen_rand_float(haversine_y_upper, haversine_y_lower);
-
-    fprintf(jsonfile, "\t\t{\"x0\": %f, \"x1\": %f, \"y0\": %f, \"y1\": %f},\n",
-            x0, x1, y0, y1);
-    // TODO: potential overflow?
-    sum += ReferenceHaversine(x0, y0, x1, y1, REF_EARTH_RADIUS_KM);
-  }
-  f64 last_x0 = gen_rand_float(haversine_x_upper, haversine_x_lower);
-  f64 last_x1 = gen_rand_float(haversine_x_upper, haversine_x_lower);
-  f64 last_y0 = gen_rand_float(haversine_y_upper, haversine_y_lower);
-  f64 last_y1 = gen_rand_float(haversine_y_upper, haversine_y_lower);
-
-  fprintf(jsonfile,
-          "\t\t{\"x0\": %f, \"x1\": %f, \"y0\": %f, \"y1\": %f}\n\t]\n}\n",
-          last_x0, last_x1, last_y0, last_y1);
-  fclose(jsonfile);
-
-  sum += ReferenceHaversine(last_x0, last_y0, last_x1, last_y1,
-                            REF_EARTH_RADIUS_KM);
-  f64 avg = sum / num_pairs;
+/*
+ * Cluster centres come from their own stream of the same seed, so they do
+ * not shift any pair's draws.
+ */
+static void gen_init_model(GenModel *model, const u64 seed) {
+  RandomStream stream = random_stream(random_mix(seed));
+  for (u32 c = 0; c < model->num_clusters; c++) {
+    model->cluster_x[c] =
+        gen_rand_float(&stream, haversine_x_upper, haversine_x_lower);
+    model->cluster_y[c] =
+        gen_rand_float(&stream, haversine_y_upper, haversine_y_lower);
+  }
+}
+
+static inline char *gen_append(char *out, const char *text, size_t len) {
+  memcpy(out, text, len);
+  return out + len;
+}
+
+/*
+ * Same bytes as
+ * "\t\t{\"x0\": %f, \"x1\": %f, \"y0\": %f, \"y1\": %f}%s\n"
+ * without going through printf. NDJSON drops the indent and the commas.
+ */
+static size_t gen_format_pair(char *out, const enum GenFormat format,
+                              const f64 x0, const f64 x1, const f64 y0,
+                              const f64 y1, const int last) {
+  char *at = out;
+  if (format == GEN_FORMAT_JSON) {
+    at = gen_append(at, "\t\t", 2);
+  }
+  at = gen_append(at, "{\"x0\": ", 7);
+  at += format_f64_fixed6(at, x0);
+  at = gen_append(at, ", \"x1\": ", 8);
+  at += format_f64_fixed6(at, x1);
+  at = gen_append(at, ", \"y0\": ", 8);
+  at += format_f64_fixed6(at, y0);
+  at = gen_append(at, ", \"y1\": ", 8);
+  at += format_f64_fixed6(at, y1);
+  at = last || format == GEN_FORMAT_NDJSON ? gen_append(at, "}\n", 2)
+                                           : gen_append(at, "},\n", 3);
+  return (size_t)(at - out);
+}
+
+// length of gen_format_pair()'s output
+static inline size_t gen_pair_len(const enum GenFormat format, const f64 x0,
+                                  const f64 x1, const f64 y0, const f64 y1,
+                                  const int last) {
+  const int json = format == GEN_FORMAT_JSON;
+  return (json ? 2 : 0) + 7 + 3 * 8 + (json && !last ? 3 : 2) +
+         format_f64_fixed6_len(x0) + format_f64_fixed6_len(x1) +
+         format_f64_fixed6_len(y0) + format_f64_fixed6_len(y1);
+}
+
+typedef struct GenChunk {
+  u64 seed;
+  const GenModel *model;
+  u64 num_pairs;
+  u64 begin;
+  u64 end;
+  enum GenFormat format;
+  char *text;
+  size_t text_len;
+  // binary output, x0, y0, x1 and y1 from pair begin on
+  f64 *columns[HAVERSINE_BINARY_COLUMNS];
+  f64 *distances;
+  f64 sum;
+} GenChunk;
+
+static void *gen_chunk(void *arg) {
+  GenChunk *chunk = arg;
+  RandomStream stream = random_stream(chunk->seed);
+
+  chunk->text_len = 0;
+  chunk->sum = 0;
+  for (u64 i = chunk->begin; i < chunk->end; i++) {
+    f64 x0, x1, y0, y1;
+    gen_rand_pair(&stream, chunk->model, i, &x0, &x1, &y0, &y1);
+    if (chunk->format == GEN_FORMAT_BIN) {
+      const u64 at = i - chunk->begin;
+      chunk->columns[0][at] = x0;
+      chunk->columns[1][at] = y0;
+      chunk->columns[2][at] = x1;
+      chunk->columns[3][at] = y1;
+    } else {
+      chunk->text_len +=
+          gen_format_pair(chunk->text + chunk->text_len, chunk->format, x0,
+                          x1, y0, y1, i + 1 == chunk->num_pairs);
+    }
+    const f64 distance =
+        ReferenceHaversine(x0, y0, x1, y1, REF_EARTH_RADIUS_KM);
+    chunk->distances[i - chunk->begin] = distance;
+    chunk->sum += distance;
+  }
+  return NULL;
+}
+
+static int gen_write_result(const f64 avg) {
   FILE *resultfile = fopen(result_filename, "w");
   if (resultfile == NULL) {
     fprintf(stderr, "Could not open file %s for writing\n", result_filename);
@@ -69,28 +284,467 @@ int gen_write_all(u32 random_seed, u32 num_pairs) {
   }
   fprintf(resultfile, "%f", avg);
   fclose(resultfile);
-
   return EXIT_SUCCESS;
 }
 
+/*
+ * Each column of a chunk goes to its own place in the file.
+ * Returns 0 if any seek or write fails.
+ */
+static int gen_write_columns(FILE *file, const HaversineBinaryHeader *header,
+                             const GenChunk *chunk) {
+  const u64 count = chunk->end - chunk->begin;
+  for (u32 c = 0; c < HAVERSINE_BINARY_COLUMNS; c++) {
+    if (fseeko(file,
+               (off_t)(header->header_size + c * header->column_stride +
+                       chunk->begin * sizeof(f64)),
+               SEEK_SET) != 0 ||
+        fwrite(chunk->columns[c], sizeof(f64), count, file) != count) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int gen_write_all(u32 random_seed, const GenModel *model, u64 num_pairs,
+                  u32 num_threads, enum GenFormat format) {
+  const char *input_filename = input_filenames[format];
+  FILE *inputfile = NULL;
+  FILE *answersfile = NULL;
+  GenChunk *chunks = NULL;
+  pthread_t *threads = NULL;
+  int result = EXIT_FAILURE;
+  inputfile = fopen(input_filename, "wb");
+  if (inputfile == NULL) {
+    fprintf(stderr, "Could not open file %s for writing\n", input_filename);
+    goto cleanup;
+  }
+  // every per-pair distance as raw f64, followed by the sum and the average
+  answersfile = fopen(answers_filename, "wb");
+  if (answersfile == NULL) {
+    fprintf(stderr, "Could not open file %s for writing\n", answers_filename);
+    goto cleanup;
+  }
+
+  chunks = calloc(num_threads, sizeof(GenChunk));
+  threads = calloc(num_threads, sizeof(pthread_t));
+  int allocated = chunks != NULL && threads != NULL;
+  for (u32 t = 0; allocated && t < num_threads; t++) {
+    chunks[t].text = malloc((size_t)GEN_CHUNK_PAIRS * GEN_MAX_RECORD_LEN);
+    chunks[t].distances = malloc(GEN_CHUNK_PAIRS * sizeof(f64));
+    allocated = chunks[t].text != NULL && chunks[t].distances != NULL;
+    // a text buffer holds the four columns of a chunk with room to spare
+    for (u32 c = 0; allocated && c < HAVERSINE_BINARY_COLUMNS; c++) {
+      chunks[t].columns[c] = (f64 *)chunks[t].text + c * GEN_CHUNK_PAIRS;
+    }
+  }
+  if (!allocated) {
+    fprintf(stderr, "Could not allocate %u generation buffers\n", num_threads);
+    goto cleanup;
+  }
+  printf("Generating %s output...\n", format_names[format]);
+
+  f64 sum = 0;
+  const HaversineBinaryHeader header = haversine_binary_header(num_pairs);
+  if (format == GEN_FORMAT_BIN &&
+      fwrite(&header, sizeof(header), 1, inputfile) != 1) {
+    fprintf(stderr, "Could not write %s\n", input_filename);
+    goto cleanup;
+  }
+  fputs(text_headers[format], inputfile);
+  for (u64 base = 0; base < num_pairs;
+       base += (u64)num_threads * GEN_CHUNK_PAIRS) {
+    u32 active = 0;
+    for (; active < num_threads; active++) {
+      const u64 begin = base + (u64)active * GEN_CHUNK_PAIRS;
+      if (begin >= num_pairs) {
+        break;
+      }
+      const u64 end = begin + GEN_CHUNK_PAIRS;
+      chunks[active].seed = random_seed;
+      chunks[active].model = model;
+      chunks[active].num_pairs = num_pairs;
+      chunks[active].format = format;
+      chunks[active].begin = begin;
+      chunks[active].end = end < num_pairs ? end : num_pairs;
+    }
+    // chunks whose thread cannot be created are generated on this one
+    u32 started = 1;
+    for (; started < active; started++) {
+      if (pthread_create(&threads[started], NULL, gen_chunk,
+                         &chunks[started]) != 0) {
+        break;
+      }
+    }
+    gen_chunk(&chunks[0]);
+    for (u32 t = started; t < active; t++) {
+      gen_chunk(&chunks[t]);
+    }
+    for (u32 t = 1; t < started; t++) {
+      pthread_join(threads[t], NULL);
+    }
+
+    for (u32 t = 0; t < active; t++) {
+      const GenChunk *chunk = &chunks[t];
+      const u64 count = chunk->end - chunk->begin;
+      const int written =
+          format == GEN_FORMAT_BIN
+              ? gen_write_columns(inputfile, &header, chunk)
+              : fwrite(chunk->text, 1, chunk->text_len, inputfile) ==
+                    chunk->text_len;
+      if (!written) {
+        fprintf(stderr, "Could not write %s\n", input_filename);
+        goto cleanup;
+      }
+      if (fwrite(chunk->distances, sizeof(f64), count, answersfile) != count) {
+        fprintf(stderr, "Could not write %s\n", answers_filename);
+        goto cleanup;
+      }
+      // TODO: potential overflow?
+      sum += chunk->sum;
+    }
+  }
+  fputs(text_footers[format], inputfile);
+  // buffered writes and the header and footer only fail here
+  const int input_failed = ferror(inputfile) | fclose(inputfile);
+  inputfile = NULL;
+  if (input_failed) {
+    fprintf(stderr, "Could not write %s\n", input_filename);
+    goto cleanup;
+  }
+
+  f64 avg = sum / num_pairs;
+  const f64 totals[2] = {sum, avg};
+  const int answers_failed =
+      (fwrite(totals, sizeof(f64), 2, answersfile) != 2) |
+      fclose(answersfile);
+  answersfile = NULL;
+  if (answers_failed) {
+    fprintf(stderr, "Could not write %s\n", answers_filename);
+    goto cleanup;
+  }
+  result = gen_write_result(avg);
+
+cleanup:
+  if (inputfile) {
+    fclose(inputfile);
+  }
+  if (answersfile) {
+    fclose(answersfile);
+  }
+  for (u32 t = 0; chunks && t < num_threads; t++) {
+    free(chunks[t].text);
+    free(chunks[t].distances);
+  }
+  free(chunks);
+  free(threads);
+  return result;
+}
+
+/*
+ * mmap output
+ *
+ * Every chunk's byte length is known before anything is formatted: the
+ * record layout is fixed and format_f64_fixed6_len() gives each number's
+ * width. A first pass measures all chunks, the files are preallocated to
+ * their exact size and mapped, and in the second pass every thread formats
+ * its chunks straight into the mapping at their final offsets. Chunks are
+ * still summed in order, so the output matches the stdio path byte for byte.
+ * Binary output has a fixed layout and needs no measuring.
+ */
+typedef struct GenMappedWorker {
+  u64 seed;
+  const GenModel *model;
+  u64 num_pairs;
+  enum GenFormat format;
+  HaversineBinaryHeader header;
+  u64 num_chunks;
+  u64 first_chunk;
+  u64 chunk_step;
+  // chunk lengths after the first pass, chunk offsets in the second
+  u64 *chunk_offsets;
+  f64 *chunk_sums;
+  char *input;
+  f64 *distances;
+} GenMappedWorker;
+
+static inline u64 gen_chunk_end(const u64 begin, const u64 num_pairs) {
+  return num_pairs - begin < GEN_CHUNK_PAIRS ? num_pairs
+                                             : begin + GEN_CHUNK_PAIRS;
+}
+
+static void *gen_measure_chunks(void *arg) {
+  GenMappedWorker *worker = arg;
+  for (u64 c = worker->first_chunk; c < worker->num_chunks;
+       c += worker->chunk_step) {
+    const u64 begin = c * GEN_CHUNK_PAIRS;
+    const u64 end = gen_chunk_end(begin, worker->num_pairs);
+    RandomStream stream = random_stream(worker->seed);
+
+    u64 len = 0;
+    for (u64 i = begin; i < end; i++) {
+      f64 x0, x1, y0, y1;
+      gen_rand_pair(&stream, worker->model, i, &x0, &x1, &y0, &y1);
+      len += gen_pair_len(worker->format, x0, x1, y0, y1,
+                          i + 1 == worker->num_pairs);
+    }
+    worker->chunk_offsets[c] = len;
+  }
+  return NULL;
+}
+
+static void *gen_fill_chunks(void *arg) {
+  GenMappedWorker *worker = arg;
+  for (u64 c = worker->first_chunk; c < worker->num_chunks;
+       c += worker->chunk_step) {
+    GenChunk chunk = {
+        .seed = worker->seed,
+        .model = worker->model,
+        .num_pairs = worker->num_pairs,
+        .begin = c * GEN_CHUNK_PAIRS,
+        .end = gen_chunk_end(c * GEN_CHUNK_PAIRS, worker->num_pairs),
+        .format = worker->format,
+        .distances = worker->distances + c * GEN_CHUNK_PAIRS,
+    };
+    if (worker->format == GEN_FORMAT_BIN) {
+      for (u32 col = 0; col < HAVERSINE_BINARY_COLUMNS; col++) {
+        chunk.columns[col] =
+            (f64 *)(worker->input + worker->header.header_size +
+                    col * worker->header.column_stride) +
+            chunk.begin;
+      }
+    } else {
+      chunk.text = worker->input + worker->chunk_offsets[c];
+    }
+    gen_chunk(&chunk);
+    worker->chunk_sums[c] = chunk.sum;
+  }
+  return NULL;
+}
+
+static void gen_run_workers(void *(*work)(void *), GenMappedWorker *workers,
+                            pthread_t *threads, const u32 num_threads) {
+  // workers whose thread cannot be created run on this one
+  u32 started = 1;
+  for (; started < num_threads; started++) {
+    if (pthread_create(&threads[started], NULL, work, &workers[started]) != 0) {
+      break;
+    }
+  }
+  work(&workers[0]);
+  for (u32 t = started; t < num_threads; t++) {
+    work(&workers[t]);
+  }
+  for (u32 t = 1; t < started; t++) {
+    pthread_join(threads[t], NULL);
+  }
+}
+
+/*
+ * Creates filename with exactly size bytes reserved on disk and maps it.
+ * Reserving up front means running out of space fails here instead of as a
+ * SIGBUS halfway through writing the mapping.
+ */
+static void *gen_map_output(const char *filename, const u64 size) {
+  const int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return NULL;
+  }
+  if (posix_fallocate(fd, 0, (off_t)size) != 0 &&
+      ftruncate(fd, (off_t)size) != 0) {
+    close(fd);
+    return NULL;
+  }
+  void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  return map == MAP_FAILED ? NULL : map;
+}
+
+/*
+ * Unlike gen_write_all() this keeps an offset and a sum per chunk, 16 bytes
+ * per GEN_CHUNK_PAIRS pairs.
+ */
+int gen_write_all_mapped(u32 random_seed, const GenModel *model,
+                         u64 num_pairs, u32 num_threads,
+                         enum GenFormat format) {
+  const u64 num_chunks = (num_pairs + GEN_CHUNK_PAIRS - 1) / GEN_CHUNK_PAIRS;
+  num_threads = num_threads < num_chunks ? num_threads : num_chunks;
+  u64 *chunk_offsets = calloc(num_chunks, sizeof(u64));
+  f64 *chunk_sums = calloc(num_chunks, sizeof(f64));
+  GenMappedWorker *workers = calloc(num_threads, sizeof(GenMappedWorker));
+  pthread_t *threads = calloc(num_threads, sizeof(pthread_t));
+  char *input = NULL;
+  f64 *distances = NULL;
+  u64 input_size = 0;
+  // every per-pair distance as raw f64, followed by the sum and the average
+  const u64 answers_size = (num_pairs + 2) * sizeof(f64);
+  int result = EXIT_FAILURE;
+  if (!chunk_offsets || !chunk_sums || !workers || !threads) {
+    fprintf(stderr, "Could not allocate %llu chunk offsets\n", num_chunks);
+    goto cleanup;
+  }
+  for (u32 t = 0; t < num_threads; t++) {
+    workers[t] = (GenMappedWorker){
+        .seed = random_seed,
+        .model = model,
+        .num_pairs = num_pairs,
+        .format = format,
+        .header = haversine_binary_header(num_pairs),
+        .num_chunks = num_chunks,
+        .first_chunk = t,
+        .chunk_step = num_threads,
+        .chunk_offsets = chunk_offsets,
+        .chunk_sums = chunk_sums,
+    };
+  }
+  const char *text_header = text_headers[format];
+  const char *text_footer = text_footers[format];
+  input_size = haversine_binary_size(&workers[0].header);
+  if (format != GEN_FORMAT_BIN) {
+    printf("Measuring %s output...\n", format_names[format]);
+    gen_run_workers(gen_measure_chunks, workers, threads, num_threads);
+
+    u64 offset = strlen(text_header);
+    for (u64 c = 0; c < num_chunks; c++) {
+      const u64 len = chunk_offsets[c];
+      chunk_offsets[c] = offset;
+      offset += len;
+    }
+    input_size = offset + strlen(text_footer);
+  }
+
+  const char *input_filename = input_filenames[format];
+  input = gen_map_output(input_filename, input_size);
+  distances = gen_map_output(answers_filename, answers_size);
+  if (!input || !distances) {
+    fprintf(stderr, "Could not map %s (%llu bytes) and %s (%llu bytes)\n",
+            input_filename, input_size, answers_filename, answers_size);
+    goto cleanup;
+  }
+  printf("Generating %s output (%llu bytes)...\n", format_names[format],
+         input_size);
+  for (u32 t = 0; t < num_threads; t++) {
+    workers[t].input = input;
+    workers[t].distances = distances;
+  }
+  if (format == GEN_FORMAT_BIN) {
+    memcpy(input, &workers[0].header, sizeof(workers[0].header));
+  }
+  memcpy(input, text_header, strlen(text_header));
+  gen_run_workers(gen_fill_chunks, workers, threads, num_threads);
+  memcpy(input + input_size - strlen(text_footer), text_footer,
+         strlen(text_footer));
+
+  f64 sum = 0;
+  for (u64 c = 0; c < num_chunks; c++) {
+    sum += chunk_sums[c];
+  }
+  f64 avg = sum / num_pairs;
+  distances[num_pairs] = sum;
+  distances[num_pairs + 1] = avg;
+  result = gen_write_result(avg);
+
+cleanup:
+  if (input) {
+    munmap(input, input_size);
+  }
+  if (distances) {
+    munmap(distances, answers_size);
+  }
+  free(chunk_offsets);
+  free(chunk_sums);
+  free(workers);
+  free(threads);
+  return result;
+}
+
 int main(int argc, char **argv) {
-  if (argc < 3) {
-    fprintf(stderr, "Usage: %s RANDOM_SEED NUM_PAIRS\n", argv[0]);
+  u32 num_threads = 1;
+  int use_mmap = 0;
+  enum GenFormat format = GEN_FORMAT_JSON;
+  // ~64 KB of cluster centres, kept off the stack
+  static GenModel model = {.num_clusters = gen_default_clusters};
+  int arg = 1;
+  for (; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg++) {
+    if (strcmp(argv[arg], "--threads") == 0 && arg + 1 < argc) {
+      arg++;
+      num_threads = atoi(argv[arg]) > 0 ? (u32)atoi(argv[arg]) : 1;
+    } else if (strcmp(argv[arg], "--mmap") == 0) {
+      use_mmap = 1;
+    } else if (strcmp(argv[arg], "--format") == 0 && arg + 1 < argc) {
+      arg++;
+      u32 f = 0;
+      while (f <= GEN_FORMAT_BIN && strcmp(argv[arg], format_names[f]) != 0) {
+        f++;
+      }
+      if (f > GEN_FORMAT_BIN) {
+        fprintf(stderr, "Unknown format %s (json, ndjson or bin)\n",
+                argv[arg]);
+        return EXIT_FAILURE;
+      }
+      format = (enum GenFormat)f;
+    } else if (strcmp(argv[arg], "--distribution") == 0 && arg + 1 < argc) {
+      arg++;
+      u32 d = 0;
+      while (d <= GEN_DIST_POLAR &&
+             strcmp(argv[arg], distribution_names[d]) != 0) {
+        d++;
+      }
+      if (d > GEN_DIST_POLAR) {
+        fprintf(stderr,
+                "Unknown distribution %s (uniform, cluster, antipodal, "
+                "duplicate or polar)\n",
+                argv[arg]);
+        return EXIT_FAILURE;
+      }
+      model.distribution = (enum GenDistribution)d;
+    } else if (strcmp(argv[arg], "--clusters") == 0 && arg + 1 < argc) {
+      arg++;
+      const int clusters = atoi(argv[arg]);
+      if (clusters <= 0 || clusters > GEN_MAX_CLUSTERS) {
+        fprintf(stderr, "--clusters takes 1 to %d centres\n",
+                GEN_MAX_CLUSTERS);
+        return EXIT_FAILURE;
+      }
+      model.num_clusters = (u32)clusters;
+    } else {
+      break;
+    }
+  }
+  if (argc - arg < 2) {
+    fprintf(stderr,
+            "Usage: %s [--threads N] [--mmap] [--format json|ndjson|bin] "
+            "[--distribution uniform|cluster|antipodal|duplicate|polar] "
+            "[--clusters N] RANDOM_SEED NUM_PAIRS\n",
+            argv[0]);
     return EXIT_FAILURE;
   } else {
-    u32 random_seed = atoi(argv[1]);
-    u32 num_pairs = atoi(argv[2]);
-    if (num_pairs == 0) {
+    u32 random_seed = atoi(argv[arg]);
+    // 64-bit and checked, atoi() into a u32 wraps past 4G pairs
+    char *end = NULL;
+    const u64 num_pairs = strtoull(argv[arg + 1], &end, 10);
+    if (num_pairs == 0 || *end != '\0' || argv[arg + 1][0] == '-') {
       fprintf(stderr, "NUM_PAIRS must be a positive integer (given %s)\n",
-              argv[2]);
+              argv[arg + 1]);
       return EXIT_FAILURE;
     }
 
     printf("Random seed: %10d\n", random_seed);
-    printf("Num pairs  : %10d\n", num_pairs);
-    const int result = gen_write_all(random_seed, num_pairs);
+    printf("Num pairs  : %10llu\n", num_pairs);
+    printf("Threads    : %10d\n", num_threads);
+    printf("Distribution: %9s\n", distribution_names[model.distribution]);
+    gen_init_model(&model, random_seed);
+    const int result =
+        use_mmap
+            ? gen_write_all_mapped(random_seed, &model, num_pairs,
+                                   num_threads, format)
+            : gen_write_all(random_seed, &model, num_pairs, num_threads,
+                            format);
     if (result == EXIT_SUCCESS) {
-      printf("Generated JSON output in file %s\n", json_filename);
+      printf("Generated %s output in file %s\n", format_names[format],
+             input_filenames[format]);
+      printf("Wrote reference answers to %s and %s\n", result_filename,
+             answers_filename);
     }
     return result;
   }
@@ -0,0 +1,72 @@
+#ifndef _BG_HAVERSINE_HEAP_C
+#define _BG_HAVERSINE_HEAP_C
+
+typedef unsigned int u32;
+typedef double       f64;
+
+/*
+ * Bounded max-heap of (key, id), kept in two parallel arrays of capacity k.
+ * The root is the largest key kept, i.e. the k-th smallest seen so far, so a
+ * new key only gets in if it is smaller than the root.
+ */
+void haversine_heap_sift_down(f64* keys, u32* ids, const u32 size, u32 at) {
+  for (;;) {
+    const u32 left    = 2 * at + 1;
+    const u32 right   = left + 1;
+    u32       largest = at;
+    if (left < size && keys[left] > keys[largest]) {
+      largest = left;
+    }
+    if (right < size && keys[right] > keys[largest]) {
+      largest = right;
+    }
+    if (largest == at) {
+      return;
+    }
+    const f64 key = keys[at];
+    const u32 id  = ids[at];
+    keys[at]      = keys[largest];
+    ids[at]       = ids[largest];
+    keys[largest] = key;
+    ids[largest]  = id;
+    at            = largest;
+  }
+}
+
+void haversine_heap_push(f64* keys, u32* ids, u32* size, const u32 k,
+                         const f64 key, const u32 id) {
+  if (!k) {
+    return;
+  }
+  if (*size < k) {
+    u32 at = (*size)++;
+    while (at > 0 && keys[(at - 1) / 2] < key) {
+      keys[at] = keys[(at - 1) / 2];
+      ids[at]  = ids[(at - 1) / 2];
+      at       = (at - 1) / 2;
+    }
+    keys[at] = key;
+    ids[at]  = id;
+  } else if (key < keys[0]) {
+    keys[0] = key;
+    ids[0]  = id;
+    haversine_heap_sift_down(keys, ids, *size, 0);
+  }
+}
+
+/*
+ * Sorts a heap of `size` entries in place, smallest key first.
+ */
+void haversine_heap_sort(f64* keys, u32* ids, const u32 size) {
+  for (u32 last = size; last > 1; last--) {
+    const f64 key  = keys[0];
+    const u32 id   = ids[0];
+    keys[0]        = keys[last - 1];
+    ids[0]         = ids[last - 1];
+    keys[last - 1] = key;
+    ids[last - 1]  = id;
+    haversine_heap_sift_down(keys, ids, last - 1, 0);
+  }
+}
+
+#endif  // _BG_HAVERSINE_HEAP_C
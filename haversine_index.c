@@ -0,0 +1,277 @@
+#ifndef _BG_HAVERSINE_INDEX_C
+#define _BG_HAVERSINE_INDEX_C
+
+#include <math.h>
+
+#include "arena.c"
+#include "haversine_heap.c"
+#include "haversine_matrix.c"
+#include "haversine_unit.c"
+
+typedef unsigned int u32;
+typedef int          i32;
+typedef double       f64;
+
+/*
+ * Lat/lon grid over a point set, for radius and k-nearest queries.
+ *
+ * The grid has (1 << bits) cells along each axis. Cells are numbered by the
+ * Morton code of (lat cell, lon cell), and the points are stored sorted by
+ * that number, so neighbouring cells are mostly neighbours in memory as well.
+ * cell_start[cell] .. cell_start[cell + 1] are the points of a cell.
+ *
+ * Queries only visit the cells inside the lat/lon bounding box of the search
+ * circle, and compare squared chords against the radius inside them, which
+ * needs no trig at all.
+ */
+typedef struct HaversineGridIndex {
+  HaversineUnitPoints points;
+  u32*                ids;
+  u32*                cell_start;
+  u32                 bits;
+  f64                 earth_radius;
+} HaversineGridIndex;
+
+static const f64 HAVERSINE_PI            = 3.14159265358979323846;
+static const f64 HAVERSINE_DEG_PER_RAD   = 57.295779513082320876798;
+static const u32 HAVERSINE_GRID_MAX_BITS = 10;
+// average points per cell the grid is sized for
+static const u32 HAVERSINE_GRID_CELL_POINTS = 16;
+
+static u32 haversine_spread_bits(u32 val) {
+  val = (val | (val << 8)) & 0x00FF00FF;
+  val = (val | (val << 4)) & 0x0F0F0F0F;
+  val = (val | (val << 2)) & 0x33333333;
+  val = (val | (val << 1)) & 0x55555555;
+  return val;
+}
+
+static inline u32 haversine_morton(const u32 lat_cell, const u32 lon_cell) {
+  return (haversine_spread_bits(lat_cell) << 1) |
+         haversine_spread_bits(lon_cell);
+}
+
+static inline u32 haversine_grid_lat_cell(const HaversineGridIndex* index,
+                                          const f64                 lat_deg) {
+  const u32 cells = 1u << index->bits;
+  const f64 pos   = (lat_deg + 90.0) / 180.0 * cells;
+  return pos <= 0 ? 0 : (pos >= cells ? cells - 1 : (u32)pos);
+}
+
+static inline u32 haversine_grid_lon_cell(const HaversineGridIndex* index,
+                                          const f64                 lon_deg) {
+  const u32 cells = 1u << index->bits;
+  const f64 pos   = (lon_deg + 180.0) / 360.0 * cells;
+  return pos <= 0 ? 0 : (pos >= cells ? cells - 1 : (u32)pos);
+}
+
+/*
+ * Points are given as lon (x) / lat (y) columns in degrees, ids are their
+ * positions in those columns.
+ */
+i32 haversine_build_grid_index(const f64* lon, const f64* lat, const u32 count,
+                               const f64 earth_radius, SimpleArena* arena,
+                               HaversineGridIndex* index) {
+  u32 bits = 1;
+  while (bits < HAVERSINE_GRID_MAX_BITS &&
+         ((u64)1 << (2 * bits)) * HAVERSINE_GRID_CELL_POINTS < count) {
+    bits++;
+  }
+  *index = (HaversineGridIndex){.bits = bits, .earth_radius = earth_radius};
+
+  const u32 num_cells = 1u << (2 * bits);
+  i32       arena_err = 0;
+  index->ids          = alloc_arena(arena, count * sizeof(u32), &arena_err);
+  index->cell_start =
+      alloc_arena(arena, (num_cells + 1) * sizeof(u32), &arena_err);
+  if (arena_err ||
+      haversine_alloc_unit_points(&index->points, count, arena)) {
+    return MEM_ALLOC_HAVERSINE_ERR_TYPE;
+  }
+  // only needed while sorting, allocated last to be handed back
+  const u64 scratch    = checkpoint_arena(arena);
+  u32*      point_cell = alloc_arena(arena, count * sizeof(u32), &arena_err);
+  if (arena_err) {
+    return MEM_ALLOC_HAVERSINE_ERR_TYPE;
+  }
+
+  // counting sort by cell
+  memset(index->cell_start, 0, (num_cells + 1) * sizeof(u32));
+  for (u32 i = 0; i < count; i++) {
+    point_cell[i] = haversine_morton(haversine_grid_lat_cell(index, lat[i]),
+                                     haversine_grid_lon_cell(index, lon[i]));
+    index->cell_start[point_cell[i] + 1]++;
+  }
+  for (u32 cell = 0; cell < num_cells; cell++) {
+    index->cell_start[cell + 1] += index->cell_start[cell];
+  }
+  for (u32 i = 0; i < count; i++) {
+    // cell_start[cell] is used as the insert cursor and restored below
+    const u32 slot = index->cell_start[point_cell[i]]++;
+    index->ids[slot] = i;
+    haversine_set_unit_point(&index->points, slot, lon[i], lat[i]);
+  }
+  for (u32 cell = num_cells; cell > 0; cell--) {
+    index->cell_start[cell] = index->cell_start[cell - 1];
+  }
+  index->cell_start[0] = 0;
+  rewind_arena(arena, scratch);
+  return NO_ERR_HAVERSINE_ERR_TYPE;
+}
+
+/*
+ * Cells covering the bounding box of a search circle. lon cells wrap around
+ * at the antimeridian, so they are given as a start and a count.
+ */
+typedef struct HaversineGridRange {
+  u32 lat_lo;
+  u32 lat_hi;
+  u32 lon_lo;
+  u32 lon_count;
+} HaversineGridRange;
+
+static HaversineGridRange haversine_grid_range(const HaversineGridIndex* index,
+                                               const f64 lon_deg,
+                                               const f64 lat_deg,
+                                               const f64 angle) {
+  const u32          cells     = 1u << index->bits;
+  const f64          angle_deg = angle * HAVERSINE_DEG_PER_RAD;
+  HaversineGridRange range     = {
+          .lat_lo    = haversine_grid_lat_cell(index, lat_deg - angle_deg),
+          .lat_hi    = haversine_grid_lat_cell(index, lat_deg + angle_deg),
+          .lon_lo    = 0,
+          .lon_count = cells,
+  };
+
+  // the circle reaches a pole: every longitude is in range
+  const f64 lat = lat_deg / HAVERSINE_DEG_PER_RAD;
+  if (fabs(lat) + angle >= 0.5 * HAVERSINE_PI) {
+    return range;
+  }
+  // widest longitude offset of a small circle of radius `angle` around lat
+  const f64 sin_ratio = sin(angle) / cos(lat);
+  if (sin_ratio >= 1.0) {
+    return range;
+  }
+  const f64 half_width = asin(sin_ratio) * HAVERSINE_DEG_PER_RAD;
+  const f64 cell_width = 360.0 / cells;
+  const f64 lon_lo     = lon_deg - half_width;
+  const u32 lon_count =
+      (u32)((lon_deg + half_width - lon_lo) / cell_width) + 2;
+  if (lon_count >= cells) {
+    return range;
+  }
+  const f64 lon_lo_wrapped = lon_lo < -180.0 ? lon_lo + 360.0 : lon_lo;
+  range.lon_lo             = haversine_grid_lon_cell(index, lon_lo_wrapped);
+  range.lon_count          = lon_count;
+  return range;
+}
+
+/*
+ * Ids of the points within radius_km of (lon, lat), up to capacity of them
+ * in no particular order. Returns how many points are in range, which can be
+ * larger than capacity.
+ */
+u32 haversine_grid_within(const HaversineGridIndex* index, const f64 lon_deg,
+                          const f64 lat_deg, const f64 radius_km,
+                          u32* out_ids, const u32 capacity) {
+  const f64 angle = radius_km / index->earth_radius;
+  const f64 max_chord_sq =
+      haversine_distance_to_chord_sq(radius_km, index->earth_radius);
+  const HaversineGridRange range =
+      haversine_grid_range(index, lon_deg, lat_deg, angle);
+
+  f64                 q[3]  = {0};
+  HaversineUnitPoints query = {.x = &q[0], .y = &q[1], .z = &q[2], .count = 1};
+  haversine_set_unit_point(&query, 0, lon_deg, lat_deg);
+
+  const u32                  cells  = 1u << index->bits;
+  const HaversineUnitPoints* points = &index->points;
+  u32                        found  = 0;
+  for (u32 lat_cell = range.lat_lo; lat_cell <= range.lat_hi; lat_cell++) {
+    for (u32 step = 0; step < range.lon_count; step++) {
+      const u32 cell =
+          haversine_morton(lat_cell, (range.lon_lo + step) % cells);
+      const u32 end = index->cell_start[cell + 1];
+      for (u32 i = index->cell_start[cell]; i < end; i++) {
+        const f64 dx = q[0] - points->x[i];
+        const f64 dy = q[1] - points->y[i];
+        const f64 dz = q[2] - points->z[i];
+        if (dx * dx + dy * dy + dz * dz <= max_chord_sq) {
+          if (found < capacity) {
+            out_ids[found] = index->ids[i];
+          }
+          found++;
+        }
+      }
+    }
+  }
+  return found;
+}
+
+/*
+ * The k nearest points to (lon, lat), nearest first: ids into out_ids and
+ * distances in km into out_distances (both k entries). Returns how many were
+ * found, which is only less than k for indexes holding fewer than k points.
+ *
+ * Searches a circle of one cell height first and doubles its radius until it
+ * holds k points; everything outside the circle is farther than anything in
+ * it, so the first circle holding k points has the answer.
+ */
+u32 haversine_grid_nearest(const HaversineGridIndex* index, const f64 lon_deg,
+                           const f64 lat_deg, const u32 k, u32* out_ids,
+                           f64* out_distances) {
+  if (!k) {
+    return 0;
+  }
+  f64                 q[3]  = {0};
+  HaversineUnitPoints query = {.x = &q[0], .y = &q[1], .z = &q[2], .count = 1};
+  haversine_set_unit_point(&query, 0, lon_deg, lat_deg);
+
+  const u32                  cells  = 1u << index->bits;
+  const HaversineUnitPoints* points = &index->points;
+  u32                        size   = 0;
+  // start with the height of one cell
+  f64                        angle  = HAVERSINE_PI / cells;
+  for (;;) {
+    const i32 whole_sphere = angle >= HAVERSINE_PI;
+    const f64 max_chord_sq =
+        whole_sphere ? 4.0
+                     : haversine_distance_to_chord_sq(
+                           angle * index->earth_radius, index->earth_radius);
+    const HaversineGridRange range =
+        haversine_grid_range(index, lon_deg, lat_deg, angle);
+
+    size = 0;
+    for (u32 lat_cell = range.lat_lo; lat_cell <= range.lat_hi; lat_cell++) {
+      for (u32 step = 0; step < range.lon_count; step++) {
+        const u32 cell =
+            haversine_morton(lat_cell, (range.lon_lo + step) % cells);
+        const u32 end = index->cell_start[cell + 1];
+        for (u32 i = index->cell_start[cell]; i < end; i++) {
+          const f64 dx       = q[0] - points->x[i];
+          const f64 dy       = q[1] - points->y[i];
+          const f64 dz       = q[2] - points->z[i];
+          const f64 chord_sq = dx * dx + dy * dy + dz * dz;
+          if (chord_sq <= max_chord_sq) {
+            haversine_heap_push(out_distances, out_ids, &size, k, chord_sq,
+                                index->ids[i]);
+          }
+        }
+      }
+    }
+    if (size == k || whole_sphere) {
+      break;
+    }
+    angle *= 2.0;
+  }
+
+  haversine_heap_sort(out_distances, out_ids, size);
+  for (u32 i = 0; i < size; i++) {
+    out_distances[i] =
+        haversine_chord_sq_to_distance(out_distances[i], index->earth_radius);
+  }
+  return size;
+}
+
+#endif  // _BG_HAVERSINE_INDEX_C
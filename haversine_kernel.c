@@ -0,0 +1,234 @@
+#ifndef _BG_HAVERSINE_KERNEL_C
+#define _BG_HAVERSINE_KERNEL_C
+
+#include <math.h>
+
+#include "haversine_formula.c"
+#include "haversine_pairs.c"
+
+typedef unsigned int u32;
+typedef int          i32;
+typedef float        f32;
+typedef double       f64;
+
+/*
+ * f64 batch kernel: the reference formula over the columns.
+ */
+f64 haversine_sum_f64(const HaversinePairs* pairs, const f64 earth_radius) {
+  f64 sum = 0;
+  for (u32 i = 0; i < pairs->count; i++) {
+    sum += ReferenceHaversine(pairs->x0[i], pairs->y0[i], pairs->x1[i],
+                              pairs->y1[i], earth_radius);
+  }
+  return sum;
+}
+
+/*
+ * Per-pair f64 distances into `out` (pairs->count entries), for validation.
+ */
+void haversine_distances_f64(const HaversinePairs* pairs,
+                             const f64 earth_radius, f64* out) {
+  for (u32 i = 0; i < pairs->count; i++) {
+    out[i] = ReferenceHaversine(pairs->x0[i], pairs->y0[i], pairs->x1[i],
+                                pairs->y1[i], earth_radius);
+  }
+}
+
+/*
+ * f32 batch kernel
+ */
+static const f32 HAVERSINE_RAD_PER_DEG_F32 = 0.01745329251994329577f;
+
+/*
+ * Polynomial sin for |x| <= pi: folded into [-pi/2, pi/2], then Taylor to
+ * x^13 (truncation error below 3e-9, under f32 rounding). Only selects and
+ * multiply-adds, so a loop over it vectorises where sinf() calls would not.
+ */
+static const f32 HAVERSINE_PI_F32      = 3.14159265358979323846f;
+static const f32 HAVERSINE_HALF_PI_F32 = 1.57079632679489661923f;
+
+static inline f32 haversine_sin_f32(const f32 x) {
+  f32 r = x;
+  r = r > HAVERSINE_HALF_PI_F32 ? HAVERSINE_PI_F32 - r : r;
+  r = r < -HAVERSINE_HALF_PI_F32 ? -HAVERSINE_PI_F32 - r : r;
+
+  const f32 r2 = r * r;
+  return r * (1.0f +
+              r2 * (-1.6666667e-1f +
+                    r2 * (8.3333333e-3f +
+                          r2 * (-1.9841270e-4f +
+                                r2 * (2.7557319e-6f +
+                                      r2 * (-2.5052108e-8f +
+                                            r2 * 1.6059044e-10f))))));
+}
+
+/*
+ * asin(sqrt(a)) for a in [0, 1], Cephes asinf polynomial. Above a = 0.25 it
+ * uses asin(x) = pi/2 - 2 * asin(sqrt((1 - x) / 2)), with 1 - x written as
+ * (1 - a) / (1 + x) to avoid the cancellation near x = 1. Both halves are
+ * computed and selected so the loop stays branch-free.
+ */
+static inline f32 haversine_asin_sqrt_f32(const f32 a) {
+  const f32 x     = sqrtf(a);
+  const int large = a > 0.25f;
+  const f32 z     = large ? 0.5f * (1.0f - a) / (1.0f + x) : a;
+  const f32 root  = sqrtf(z);
+  const f32 s     = large ? root : x;
+
+  const f32 p = ((((4.2163199048e-2f * z + 2.4181311049e-2f) * z +
+                   4.5470025998e-2f) *
+                      z +
+                  7.4953002686e-2f) *
+                     z +
+                 1.6666752422e-1f) *
+                z;
+  const f32 r = s + s * p;
+  return large ? HAVERSINE_HALF_PI_F32 - 2.0f * r : r;
+}
+
+/*
+ * Same formula as ReferenceHaversine, in single precision. `a` is clamped
+ * because rounding can push it just above 1. cos(lat) is sin(pi/2 - |lat|).
+ */
+static inline f32 haversine_f32(const f32 x0, const f32 y0, const f32 x1,
+                                const f32 y1, const f32 earth_radius) {
+  const f32 d_lat     = HAVERSINE_RAD_PER_DEG_F32 * (y1 - y0);
+  const f32 d_lon     = HAVERSINE_RAD_PER_DEG_F32 * (x1 - x0);
+  const f32 lat0      = HAVERSINE_RAD_PER_DEG_F32 * y0;
+  const f32 lat1      = HAVERSINE_RAD_PER_DEG_F32 * y1;
+  const f32 sin_d_lat = haversine_sin_f32(0.5f * d_lat);
+  const f32 sin_d_lon = haversine_sin_f32(0.5f * d_lon);
+  const f32 cos_lat0  = haversine_sin_f32(HAVERSINE_HALF_PI_F32 - fabsf(lat0));
+  const f32 cos_lat1  = haversine_sin_f32(HAVERSINE_HALF_PI_F32 - fabsf(lat1));
+
+  f32 a = sin_d_lat * sin_d_lat + cos_lat0 * cos_lat1 * sin_d_lon * sin_d_lon;
+  a     = a > 1.0f ? 1.0f : a;
+  a     = a < 0.0f ? 0.0f : a;
+  return earth_radius * 2.0f * haversine_asin_sqrt_f32(a);
+}
+
+/*
+ * Pairs summed in f32 per block, blocks summed in f64, so the inner loop stays
+ * single precision without the total drifting over millions of pairs.
+ * Distances go through a block buffer and HAVERSINE_F32_LANES partial sums:
+ * a single running f32 sum is a serial dependency the compiler may not
+ * reorder, the lanes make the reassociation explicit.
+ */
+#define HAVERSINE_F32_BLOCK_SIZE 256
+#define HAVERSINE_F32_LANES      8
+
+f64 haversine_sum_f32(const HaversinePairs32* pairs, const f32 earth_radius) {
+  f32 dist[HAVERSINE_F32_BLOCK_SIZE];
+  f64 sum = 0;
+  for (u32 base = 0; base < pairs->count; base += HAVERSINE_F32_BLOCK_SIZE) {
+    const f32* x0 = pairs->x0 + base;
+    const f32* y0 = pairs->y0 + base;
+    const f32* x1 = pairs->x1 + base;
+    const f32* y1 = pairs->y1 + base;
+    u32        n  = pairs->count - base;
+    if (n >= HAVERSINE_F32_BLOCK_SIZE) {
+      // constant trip count: no epilogue, so -O2 vectorises it
+      n = HAVERSINE_F32_BLOCK_SIZE;
+      for (u32 i = 0; i < HAVERSINE_F32_BLOCK_SIZE; i++) {
+        dist[i] = haversine_f32(x0[i], y0[i], x1[i], y1[i], earth_radius);
+      }
+    } else {
+      for (u32 i = 0; i < n; i++) {
+        dist[i] = haversine_f32(x0[i], y0[i], x1[i], y1[i], earth_radius);
+      }
+    }
+
+    f32 lanes[HAVERSINE_F32_LANES] = {0};
+    u32 i                          = 0;
+    for (; i + HAVERSINE_F32_LANES <= n; i += HAVERSINE_F32_LANES) {
+      for (u32 l = 0; l < HAVERSINE_F32_LANES; l++) {
+        lanes[l] += dist[i + l];
+      }
+    }
+    for (; i < n; i++) {
+      lanes[0] += dist[i];
+    }
+
+    f32 block_sum = 0;
+    for (u32 l = 0; l < HAVERSINE_F32_LANES; l++) {
+      block_sum += lanes[l];
+    }
+    sum += block_sum;
+  }
+  return sum;
+}
+
+void haversine_distances_f32(const HaversinePairs32* pairs,
+                             const f32 earth_radius, f64* out) {
+  for (u32 i = 0; i < pairs->count; i++) {
+    out[i] = haversine_f32(pairs->x0[i], pairs->y0[i], pairs->x1[i],
+                           pairs->y1[i], earth_radius);
+  }
+}
+
+/*
+ * f32 error-bound verification
+ */
+typedef struct HaversineF32Check {
+  f64 avg_f64;
+  f64 avg_f32;
+  // |avg_f32 - avg_f64|, what gets compared with the tolerance
+  f64 avg_deviation;
+  // worst single pair, an upper bound for the deviation of any subset average
+  f64 max_pair_deviation;
+} HaversineF32Check;
+
+/*
+ * Runs the f32 kernel and the f64 reference on the same dataset.
+ * Returns the f32 average, or sets TOLERANCE_EXCEEDED_HAVERSINE_ERR_TYPE and
+ * returns 0 if it is further than `tolerance_km` from the reference.
+ * This pays for a full f64 pass on top of the f32 one: it is the validation
+ * mode, haversine_sum_f32 alone is the fast path.
+ */
+f64 haversine_avg_f32_checked(const HaversinePairs*   pairs,
+                              const HaversinePairs32* pairs32,
+                              const f64 earth_radius, const f64 tolerance_km,
+                              HaversineF32Check* check, i32* err) {
+  if (!pairs || !pairs32 || !check) {
+    *err = NULL_POINTER_HAVERSINE_ERR_TYPE;
+    return 0;
+  }
+  if (!pairs->count || pairs->count != pairs32->count) {
+    *err = INVALID_INPUT_HAVERSINE_ERR_TYPE;
+    return 0;
+  }
+
+  f64 sum_f64            = 0;
+  f64 max_pair_deviation = 0;
+  for (u32 i = 0; i < pairs->count; i++) {
+    const f64 dist_f64 = ReferenceHaversine(pairs->x0[i], pairs->y0[i],
+                                            pairs->x1[i], pairs->y1[i],
+                                            earth_radius);
+    const f64 dist_f32 =
+        haversine_f32(pairs32->x0[i], pairs32->y0[i], pairs32->x1[i],
+                      pairs32->y1[i], (f32)earth_radius);
+    const f64 deviation = fabs(dist_f32 - dist_f64);
+    max_pair_deviation  = deviation > max_pair_deviation ? deviation
+                                                         : max_pair_deviation;
+    sum_f64 += dist_f64;
+  }
+
+  const f64 avg_f64 = sum_f64 / pairs->count;
+  const f64 avg_f32 =
+      haversine_sum_f32(pairs32, (f32)earth_radius) / pairs32->count;
+  *check = (HaversineF32Check){
+      .avg_f64            = avg_f64,
+      .avg_f32            = avg_f32,
+      .avg_deviation      = fabs(avg_f32 - avg_f64),
+      .max_pair_deviation = max_pair_deviation,
+  };
+
+  if (check->avg_deviation > tolerance_km) {
+    *err = TOLERANCE_EXCEEDED_HAVERSINE_ERR_TYPE;
+    return 0;
+  }
+  *err = NO_ERR_HAVERSINE_ERR_TYPE;
+  return check->avg_f32;
+}
+
+#endif  // _BG_HAVERSINE_KERNEL_C
@@ -0,0 +1,201 @@
+#ifndef _BG_HAVERSINE_MATRIX_C
+#define _BG_HAVERSINE_MATRIX_C
+
+#include <math.h>
+
+#include "haversine_unit.c"
+
+typedef unsigned int       u32;
+typedef unsigned long long u64;
+typedef double             f64;
+
+/*
+ * All-pairs great-circle distances between two unit-vector point sets.
+ *
+ * The column set is walked in tiles of HAVERSINE_MATRIX_TILE_COLS points
+ * (3 * 8 KB of f64 components, sized to stay in L1) and every row is run
+ * against a tile before moving to the next one. The full matrix also tiles
+ * the rows by HAVERSINE_MATRIX_TILE_ROWS and hands each finished tile to a
+ * callback, since a whole rows x cols matrix of f64 is 8 * N^2 bytes and past
+ * memory long before the pair counts this tool handles.
+ *
+ * The reductions never call asin() in the inner loop: the squared chord is
+ * monotonic in the distance, so minima and thresholds are compared on it and
+ * only converted to kilometres once per row. At -O2 gcc 12 keeps the compare
+ * loops scalar (-fopt-info-vec-missed: no index-of-min or mixed-width count
+ * reductions under the cheap cost model); the full matrix's chord loop over a
+ * whole column tile is the one that vectorises.
+ */
+#define HAVERSINE_MATRIX_TILE_ROWS 64
+#define HAVERSINE_MATRIX_TILE_COLS 1024
+
+static inline u32 haversine_matrix_min_u32(const u32 lhs, const u32 rhs) {
+  return lhs < rhs ? lhs : rhs;
+}
+
+static inline f64 haversine_chord_sq_to_distance(const f64 chord_sq,
+                                                 const f64 earth_radius) {
+  f64 half_chord = 0.5 * sqrt(chord_sq);
+  half_chord     = half_chord > 1.0 ? 1.0 : half_chord;
+  return earth_radius * 2.0 * asin(half_chord);
+}
+
+/*
+ * Inverse of haversine_chord_sq_to_distance(). Distances past half the
+ * circumference map to the largest possible chord (the diameter).
+ */
+static inline f64 haversine_distance_to_chord_sq(const f64 distance,
+                                                 const f64 earth_radius) {
+  const f64 angle = distance / earth_radius;
+  if (angle >= 3.14159265358979323846) {
+    return 4.0;
+  }
+  const f64 half_chord = sin(0.5 * angle);
+  return 4.0 * half_chord * half_chord;
+}
+
+/*
+ * Called once per tile with the distances in kilometres of rows [row_base,
+ * row_base + row_count) against cols [col_base, col_base + col_count). Row r
+ * of the tile starts at tile + r * HAVERSINE_MATRIX_TILE_COLS; the buffer is
+ * reused for the next tile once the callback returns.
+ */
+typedef void (*HaversineMatrixTileFn)(void* ctx, u32 row_base, u32 row_count,
+                                      u32 col_base, u32 col_count,
+                                      const f64* tile);
+
+/*
+ * Full rows x cols distance matrix, one tile at a time. `tile` holds
+ * HAVERSINE_MATRIX_TILE_ROWS * HAVERSINE_MATRIX_TILE_COLS entries (512 KB).
+ */
+void haversine_matrix_tiles(const HaversineUnitPoints* rows,
+                            const HaversineUnitPoints* cols,
+                            const f64 earth_radius, f64* tile,
+                            HaversineMatrixTileFn on_tile, void* ctx) {
+  // local, so the compiler knows it does not alias the point columns
+  f64 chord_sq[HAVERSINE_MATRIX_TILE_COLS];
+  for (u32 col_base = 0; col_base < cols->count;
+       col_base += HAVERSINE_MATRIX_TILE_COLS) {
+    const u32  col_count = haversine_matrix_min_u32(
+        cols->count - col_base, HAVERSINE_MATRIX_TILE_COLS);
+    const f64* cx        = cols->x + col_base;
+    const f64* cy        = cols->y + col_base;
+    const f64* cz        = cols->z + col_base;
+    for (u32 row_base = 0; row_base < rows->count;
+         row_base += HAVERSINE_MATRIX_TILE_ROWS) {
+      const u32 row_count = haversine_matrix_min_u32(
+          rows->count - row_base, HAVERSINE_MATRIX_TILE_ROWS);
+      for (u32 r = 0; r < row_count; r++) {
+        const f64 ax = rows->x[row_base + r];
+        const f64 ay = rows->y[row_base + r];
+        const f64 az = rows->z[row_base + r];
+        if (col_count == HAVERSINE_MATRIX_TILE_COLS) {
+          // constant trip count: no epilogue, so -O2 vectorises it
+          for (u32 c = 0; c < HAVERSINE_MATRIX_TILE_COLS; c++) {
+            const f64 dx = ax - cx[c];
+            const f64 dy = ay - cy[c];
+            const f64 dz = az - cz[c];
+            chord_sq[c]  = dx * dx + dy * dy + dz * dz;
+          }
+        } else {
+          for (u32 c = 0; c < col_count; c++) {
+            const f64 dx = ax - cx[c];
+            const f64 dy = ay - cy[c];
+            const f64 dz = az - cz[c];
+            chord_sq[c]  = dx * dx + dy * dy + dz * dz;
+          }
+        }
+        f64* tile_row = tile + (u64)r * HAVERSINE_MATRIX_TILE_COLS;
+        for (u32 c = 0; c < col_count; c++) {
+          tile_row[c] =
+              haversine_chord_sq_to_distance(chord_sq[c], earth_radius);
+        }
+      }
+      on_tile(ctx, row_base, row_count, col_base, col_count, tile);
+    }
+  }
+}
+
+/*
+ * Nearest column point for every row point: min_distance[r] in kilometres and
+ * min_idx[r] into cols. Both arrays hold rows->count entries.
+ */
+void haversine_matrix_row_min(const HaversineUnitPoints* rows,
+                              const HaversineUnitPoints* cols,
+                              const f64 earth_radius, f64* min_distance,
+                              u32* min_idx) {
+  // min_distance holds squared chords until the last tile is done
+  for (u32 r = 0; r < rows->count; r++) {
+    min_distance[r] = 5.0;
+    min_idx[r]      = 0;
+  }
+  for (u32 col_base = 0; col_base < cols->count;
+       col_base += HAVERSINE_MATRIX_TILE_COLS) {
+    const u32 col_end = haversine_matrix_min_u32(
+        cols->count - col_base, HAVERSINE_MATRIX_TILE_COLS) + col_base;
+    for (u32 r = 0; r < rows->count; r++) {
+      const f64 ax       = rows->x[r];
+      const f64 ay       = rows->y[r];
+      const f64 az       = rows->z[r];
+      f64       best     = min_distance[r];
+      u32       best_idx = min_idx[r];
+      for (u32 c = col_base; c < col_end; c++) {
+        const f64 dx       = ax - cols->x[c];
+        const f64 dy       = ay - cols->y[c];
+        const f64 dz       = az - cols->z[c];
+        const f64 chord_sq = dx * dx + dy * dy + dz * dz;
+        if (chord_sq < best) {
+          best     = chord_sq;
+          best_idx = c;
+        }
+      }
+      min_distance[r] = best;
+      min_idx[r]      = best_idx;
+    }
+  }
+  for (u32 r = 0; r < rows->count; r++) {
+    min_distance[r] =
+        haversine_chord_sq_to_distance(min_distance[r], earth_radius);
+  }
+}
+
+/*
+ * Number of column points within `threshold` kilometres of every row point,
+ * into counts (rows->count entries). Returns the total over all rows.
+ */
+u64 haversine_matrix_count_within(const HaversineUnitPoints* rows,
+                                  const HaversineUnitPoints* cols,
+                                  const f64 earth_radius, const f64 threshold,
+                                  u32* counts) {
+  const f64 threshold_chord_sq =
+      haversine_distance_to_chord_sq(threshold, earth_radius);
+  for (u32 r = 0; r < rows->count; r++) {
+    counts[r] = 0;
+  }
+  for (u32 col_base = 0; col_base < cols->count;
+       col_base += HAVERSINE_MATRIX_TILE_COLS) {
+    const u32 col_end = haversine_matrix_min_u32(
+        cols->count - col_base, HAVERSINE_MATRIX_TILE_COLS) + col_base;
+    for (u32 r = 0; r < rows->count; r++) {
+      const f64 ax    = rows->x[r];
+      const f64 ay    = rows->y[r];
+      const f64 az    = rows->z[r];
+      u32       count = 0;
+      for (u32 c = col_base; c < col_end; c++) {
+        const f64 dx = ax - cols->x[c];
+        const f64 dy = ay - cols->y[c];
+        const f64 dz = az - cols->z[c];
+        count += (dx * dx + dy * dy + dz * dz) <= threshold_chord_sq;
+      }
+      counts[r] += count;
+    }
+  }
+
+  u64 total = 0;
+  for (u32 r = 0; r < rows->count; r++) {
+    total += counts[r];
+  }
+  return total;
+}
+
+#endif  // _BG_HAVERSINE_MATRIX_C
@@ -0,0 +1,398 @@
+#ifndef _BG_HAVERSINE_PACKED_C
+#define _BG_HAVERSINE_PACKED_C
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "arena.c"
+#include "haversine_pairs.c"
+
+typedef unsigned char      u8;
+typedef unsigned int       u32;
+typedef unsigned long long u64;
+typedef int                i32;
+typedef long long          i64;
+typedef double             f64;
+
+/*
+ * Packed coordinate columns
+ *
+ * The generator writes 6 decimals, so every coordinate is an integer number
+ * of micro-degrees: at most 29 bits instead of 64. Pairs are cut into blocks
+ * of HAVERSINE_PACK_BLOCK_PAIRS; within a block every column stores its
+ * minimum and then each value's offset from it, bit-packed at the width of
+ * the block's range: 28-29 bits for coordinates spread over the globe, a
+ * few bits for end points stored as small differences from their start.
+ *
+ * File: a 64-byte header, the u64 file offset of every block plus one past
+ * the last, then the blocks. A block holds the x0, y0, x1 and y1 columns in
+ * turn, each as an i32 base, a u32 width and the packed bits padded to whole
+ * u64s plus one spare u64, so the decoder can always load 8 bytes at once.
+ * The second byte of the width marks an end column stored as differences
+ * from its start column.
+ *
+ * Decoding is one fixed-width, branch-free loop per column that writes f64
+ * batch columns the kernels take as they are. n / 10^6 is correctly rounded,
+ * so it gives back exactly the f64 a parser reads from "%f" text; the encoder
+ * refuses values for which this would not hold.
+ */
+#define HAVERSINE_PACK_BLOCK_PAIRS 256
+#define HAVERSINE_PACK_COLUMNS 4
+
+static const char HAVERSINE_PACK_MAGIC[8] = {'H', 'A', 'V', 'P',
+                                             'A', 'C', 'K', 'D'};
+static const u32  HAVERSINE_PACK_VERSION  = 1;
+static const f64  HAVERSINE_PACK_SCALE    = 1e6;
+
+typedef struct HaversinePackHeader {
+  char magic[8];
+  u32  version;
+  u32  header_size;
+  u64  count;
+  u64  block_count;
+  u8   reserved[32];
+} HaversinePackHeader;
+
+typedef struct HaversinePackedFile {
+  void*                      map;
+  u64                        size;
+  const HaversinePackHeader* header;
+  const u64*                 block_offsets;
+} HaversinePackedFile;
+
+// bytes a packed column of n values at width bits takes, spare u64 included
+static inline u64 haversine_packed_column_size(const u32 n, const u32 width) {
+  return 8 + ((u64)n * width + 63) / 64 * 8 + 8;
+}
+
+static inline u64 haversine_pack_block_count(const u64 count) {
+  return (count + HAVERSINE_PACK_BLOCK_PAIRS - 1) / HAVERSINE_PACK_BLOCK_PAIRS;
+}
+
+/*
+ * Coordinates in micro-degrees. Returns 0 if a value is not a whole number
+ * of them.
+ */
+static i32 haversine_pack_scale(const f64* values, const u32 n, i32* out) {
+  for (u32 i = 0; i < n; i++) {
+    const f64 rounded = round(values[i] * HAVERSINE_PACK_SCALE);
+    if (!(fabs(rounded) < 1073741824.0) ||
+        rounded / HAVERSINE_PACK_SCALE != values[i]) {
+      return 0;
+    }
+    out[i] = (i32)rounded;
+  }
+  return 1;
+}
+
+static u32 haversine_pack_width(const i32* values, const u32 n, i32* min) {
+  i32 max = values[0];
+  *min    = values[0];
+  for (u32 i = 1; i < n; i++) {
+    *min = values[i] < *min ? values[i] : *min;
+    max  = values[i] > max ? values[i] : max;
+  }
+  const u64 range = (u64)((i64)max - (i64)*min);
+  u32       width = 0;
+  while (width < 32 && (range >> width)) {
+    width++;
+  }
+  return width;
+}
+
+/*
+ * Packs n values into out and returns the bytes written. delta only marks
+ * the column for the decoder, the values are already differences.
+ */
+static u64 haversine_pack_column(const i32* values, const u32 n,
+                                 const u32 delta, u8* out) {
+  i32       min   = 0;
+  const u32 width = haversine_pack_width(values, n, &min);
+  const u64 size  = haversine_packed_column_size(n, width);
+  const u32 info  = width | delta << 8;
+  memset(out, 0, size);
+  memcpy(out, &min, sizeof(min));
+  memcpy(out + 4, &info, sizeof(info));
+  u64* words = (u64*)(out + 8);
+  for (u32 i = 0; i < n && width; i++) {
+    const u64 offset = (u64)((i64)values[i] - (i64)min);
+    const u64 bit    = (u64)i * width;
+    words[bit / 64] |= offset << (bit % 64);
+    if (bit % 64 + width > 64) {
+      words[bit / 64 + 1] |= offset >> (64 - bit % 64);
+    }
+  }
+  return size;
+}
+
+/*
+ * Micro-degrees of one column into out; delta columns add start, the
+ * decoded start column of the same point.
+ */
+static const u8* haversine_unpack_column(const u8* in, const u32 n,
+                                         const i32* start, i32* out) {
+  i32 base = 0;
+  u32 info = 0;
+  memcpy(&base, in, sizeof(base));
+  memcpy(&info, in + 4, sizeof(info));
+  const u32 width = info & 0xFF;
+  const u8* bits  = in + 8;
+  const u64 mask  = width ? ~0ull >> (64 - width) : 0;
+  for (u32 i = 0; i < n; i++) {
+    // width <= 32, so a value always lies within the 8 bytes at its first bit
+    const u64 bit  = (u64)i * width;
+    u64       word = 0;
+    memcpy(&word, bits + bit / 8, sizeof(word));
+    out[i] = (i32)((i64)base + (i64)((word >> (bit % 8)) & mask));
+  }
+  if (info >> 8) {
+    for (u32 i = 0; i < n; i++) {
+      out[i] += start[i];
+    }
+  }
+  return in + haversine_packed_column_size(n, width);
+}
+
+static inline void haversine_unscale(const i32* values, const u32 n,
+                                     f64* out) {
+  for (u32 i = 0; i < n; i++) {
+    out[i] = (f64)values[i] / HAVERSINE_PACK_SCALE;
+  }
+}
+
+/*
+ * Packs one block into out and returns its size, 0 if a coordinate has more
+ * than 6 decimals. End points are stored as differences from the start point
+ * when that is narrower, which is what near-duplicate pairs compress on.
+ */
+static u64 haversine_pack_block(const HaversinePairs* pairs, const u32 begin,
+                                const u32 n, u8* out) {
+  i32 scaled[HAVERSINE_PACK_COLUMNS][HAVERSINE_PACK_BLOCK_PAIRS];
+  i32 diff[HAVERSINE_PACK_BLOCK_PAIRS];
+  if (!haversine_pack_scale(pairs->x0 + begin, n, scaled[0]) ||
+      !haversine_pack_scale(pairs->y0 + begin, n, scaled[1]) ||
+      !haversine_pack_scale(pairs->x1 + begin, n, scaled[2]) ||
+      !haversine_pack_scale(pairs->y1 + begin, n, scaled[3])) {
+    return 0;
+  }
+  u64 size = haversine_pack_column(scaled[0], n, 0, out);
+  size += haversine_pack_column(scaled[1], n, 0, out + size);
+  for (u32 c = 2; c < HAVERSINE_PACK_COLUMNS; c++) {
+    for (u32 i = 0; i < n; i++) {
+      diff[i] = scaled[c][i] - scaled[c - 2][i];
+    }
+    i32       min   = 0;
+    const u32 delta = haversine_pack_width(diff, n, &min) <
+                      haversine_pack_width(scaled[c], n, &min);
+    size += haversine_pack_column(delta ? diff : scaled[c], n, delta,
+                                  out + size);
+  }
+  return size;
+}
+
+/*
+ * Writes the pairs packed to path. INVALID_INPUT_HAVERSINE_ERR_TYPE if a
+ * coordinate has more than 6 decimals.
+ */
+i32 haversine_write_packed(const char* path, const HaversinePairs* pairs,
+                           u64* packed_size) {
+  const u64           block_count = haversine_pack_block_count(pairs->count);
+  HaversinePackHeader header      = {
+           .version     = HAVERSINE_PACK_VERSION,
+           .header_size = sizeof(HaversinePackHeader),
+           .count       = pairs->count,
+           .block_count = block_count,
+  };
+  memcpy(header.magic, HAVERSINE_PACK_MAGIC, sizeof(header.magic));
+
+  u64* offsets = malloc((block_count + 1) * sizeof(u64));
+  u8*  block   = malloc(HAVERSINE_PACK_COLUMNS *
+                        haversine_packed_column_size(HAVERSINE_PACK_BLOCK_PAIRS,
+                                                     32));
+  FILE* file   = fopen(path, "wb");
+  if (!offsets || !block || !file) {
+    free(offsets);
+    free(block);
+    if (file) {
+      fclose(file);
+    }
+    return offsets && block ? FILE_IO_HAVERSINE_ERR_TYPE
+                            : MEM_ALLOC_HAVERSINE_ERR_TYPE;
+  }
+
+  // the directory is written last, once the block sizes are known
+  u64 offset = sizeof(header) + (block_count + 1) * sizeof(u64);
+  fseeko(file, (off_t)offset, SEEK_SET);
+  i32 err = NO_ERR_HAVERSINE_ERR_TYPE;
+  for (u64 b = 0; !err && b < block_count; b++) {
+    const u32 begin = (u32)(b * HAVERSINE_PACK_BLOCK_PAIRS);
+    const u32 n     = pairs->count - begin < HAVERSINE_PACK_BLOCK_PAIRS
+                          ? pairs->count - begin
+                          : HAVERSINE_PACK_BLOCK_PAIRS;
+    const u64 block_size = haversine_pack_block(pairs, begin, n, block);
+    err = block_size ? err : INVALID_INPUT_HAVERSINE_ERR_TYPE;
+    if (!err && fwrite(block, 1, block_size, file) != block_size) {
+      err = FILE_IO_HAVERSINE_ERR_TYPE;
+    }
+    offsets[b] = offset;
+    offset += block_size;
+  }
+  offsets[block_count] = offset;
+  fseeko(file, 0, SEEK_SET);
+  if (!err && (fwrite(&header, sizeof(header), 1, file) != 1 ||
+               fwrite(offsets, sizeof(u64), block_count + 1, file) !=
+                   block_count + 1)) {
+    err = FILE_IO_HAVERSINE_ERR_TYPE;
+  }
+  err = fclose(file) && !err ? FILE_IO_HAVERSINE_ERR_TYPE : err;
+  free(offsets);
+  free(block);
+  *packed_size = offset;
+  return err;
+}
+
+/*
+ * Checks that the columns of a block of n pairs fit in [begin, end) with
+ * widths the decoder handles, reading only the column headers. Only end
+ * columns may be stored as differences, the start columns have no start.
+ */
+static i32 haversine_packed_block_valid(const u8* map, const u64 begin,
+                                        const u64 end, const u32 n) {
+  u64 at = begin;
+  for (u32 c = 0; c < HAVERSINE_PACK_COLUMNS; c++) {
+    u32 info = 0;
+    if (end - at < 8) {
+      return 0;
+    }
+    memcpy(&info, map + at + 4, sizeof(info));
+    const u32 width = info & 0xFF;
+    const u32 delta = info >> 8;
+    if (width > 32 || delta > (c >= 2)) {
+      return 0;
+    }
+    const u64 size = haversine_packed_column_size(n, width);
+    if (end - at < size) {
+      return 0;
+    }
+    at += size;
+  }
+  return 1;
+}
+
+/*
+ * PARSE_HAVERSINE_ERR_TYPE when path is not a packed file, or when its
+ * directory or a block header is inconsistent: the block offsets have to be
+ * ordered and inside the file, and every block has to hold its columns.
+ * Release with haversine_unmap_packed().
+ */
+i32 haversine_map_packed(const char* path, HaversinePackedFile* packed) {
+  *packed      = (HaversinePackedFile){0};
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return FILE_IO_HAVERSINE_ERR_TYPE;
+  }
+  const off_t size = lseek(fd, 0, SEEK_END);
+  if (size < (off_t)sizeof(HaversinePackHeader)) {
+    close(fd);
+    return PARSE_HAVERSINE_ERR_TYPE;
+  }
+  void* map = mmap(0, (size_t)size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return FILE_IO_HAVERSINE_ERR_TYPE;
+  }
+  const HaversinePackHeader* header = map;
+  const u64* offsets = (const u64*)((const u8*)map + sizeof(*header));
+  i32        valid   =
+      !memcmp(header->magic, HAVERSINE_PACK_MAGIC, sizeof(header->magic)) &&
+      header->version == HAVERSINE_PACK_VERSION &&
+      header->block_count == haversine_pack_block_count(header->count) &&
+      // bounded first so the directory size cannot wrap
+      header->block_count < (u64)size / 8 &&
+      sizeof(*header) + (header->block_count + 1) * 8 <= (u64)size &&
+      offsets[header->block_count] == (u64)size;
+  u64 block_begin = sizeof(*header) + (header->block_count + 1) * 8;
+  for (u64 b = 0; valid && b < header->block_count; b++) {
+    const u64 begin = b * HAVERSINE_PACK_BLOCK_PAIRS;
+    const u32 n     = header->count - begin < HAVERSINE_PACK_BLOCK_PAIRS
+                          ? (u32)(header->count - begin)
+                          : HAVERSINE_PACK_BLOCK_PAIRS;
+    valid = offsets[b] >= block_begin && offsets[b] <= offsets[b + 1] &&
+            haversine_packed_block_valid(map, offsets[b], offsets[b + 1], n);
+    block_begin = offsets[b];
+  }
+  if (!valid) {
+    munmap(map, (size_t)size);
+    return PARSE_HAVERSINE_ERR_TYPE;
+  }
+  *packed = (HaversinePackedFile){
+      .map           = map,
+      .size          = (u64)size,
+      .header        = header,
+      .block_offsets = offsets,
+  };
+  return NO_ERR_HAVERSINE_ERR_TYPE;
+}
+
+void haversine_unmap_packed(HaversinePackedFile* packed) {
+  if (packed->map) {
+    munmap(packed->map, packed->size);
+  }
+  *packed = (HaversinePackedFile){0};
+}
+
+/*
+ * Decodes block b into the first entries of the columns of out and sets
+ * out->count to its number of pairs.
+ */
+void haversine_unpack_block(const HaversinePackedFile* packed, const u64 b,
+                            HaversinePairs* out) {
+  const u64 begin = b * HAVERSINE_PACK_BLOCK_PAIRS;
+  const u32 n     = packed->header->count - begin < HAVERSINE_PACK_BLOCK_PAIRS
+                        ? (u32)(packed->header->count - begin)
+                        : HAVERSINE_PACK_BLOCK_PAIRS;
+  const u8* at    = (const u8*)packed->map + packed->block_offsets[b];
+  i32       scaled[HAVERSINE_PACK_COLUMNS][HAVERSINE_PACK_BLOCK_PAIRS];
+  at = haversine_unpack_column(at, n, 0, scaled[0]);
+  at = haversine_unpack_column(at, n, 0, scaled[1]);
+  at = haversine_unpack_column(at, n, scaled[0], scaled[2]);
+  haversine_unpack_column(at, n, scaled[1], scaled[3]);
+  haversine_unscale(scaled[0], n, out->x0);
+  haversine_unscale(scaled[1], n, out->y0);
+  haversine_unscale(scaled[2], n, out->x1);
+  haversine_unscale(scaled[3], n, out->y1);
+  out->count = n;
+}
+
+/*
+ * Decodes every block into columns allocated from the arena.
+ */
+i32 haversine_unpack_pairs(const HaversinePackedFile* packed,
+                           SimpleArena* arena, HaversinePairs* pairs) {
+  if (packed->header->count > (u32)-1) {
+    return INVALID_INPUT_HAVERSINE_ERR_TYPE;
+  }
+  const i32 err =
+      haversine_alloc_pairs(pairs, (u32)packed->header->count, arena);
+  if (err) {
+    return err;
+  }
+  for (u64 b = 0; b < packed->header->block_count; b++) {
+    const u64      begin = b * HAVERSINE_PACK_BLOCK_PAIRS;
+    HaversinePairs block = {
+        .x0 = pairs->x0 + begin,
+        .y0 = pairs->y0 + begin,
+        .x1 = pairs->x1 + begin,
+        .y1 = pairs->y1 + begin,
+    };
+    haversine_unpack_block(packed, b, &block);
+  }
+  return NO_ERR_HAVERSINE_ERR_TYPE;
+}
+
+#endif  // _BG_HAVERSINE_PACKED_C
@@ -0,0 +1,439 @@
+#ifndef _BG_HAVERSINE_PAIRS_C
+#define _BG_HAVERSINE_PAIRS_C
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.c"
+
+typedef unsigned int       u32;
+typedef unsigned long long u64;
+typedef int                i32;
+typedef float              f32;
+typedef double             f64;
+
+/*
+ * Column (SoA) layout of the generated pairs, one array per coordinate.
+ */
+typedef struct HaversinePairs {
+  f64* x0;
+  f64* y0;
+  f64* x1;
+  f64* y1;
+  u32  count;
+} HaversinePairs;
+
+typedef struct HaversinePairs32 {
+  f32* x0;
+  f32* y0;
+  f32* x1;
+  f32* y1;
+  u32  count;
+} HaversinePairs32;
+
+enum HaversineErrorType {
+  NO_ERR_HAVERSINE_ERR_TYPE = 0,
+  NULL_POINTER_HAVERSINE_ERR_TYPE,
+  FILE_IO_HAVERSINE_ERR_TYPE,
+  PARSE_HAVERSINE_ERR_TYPE,
+  MEM_ALLOC_HAVERSINE_ERR_TYPE,
+  INVALID_INPUT_HAVERSINE_ERR_TYPE,
+  TOLERANCE_EXCEEDED_HAVERSINE_ERR_TYPE,
+};
+
+const char* haversine_err_to_cstr(const enum HaversineErrorType haversine_err) {
+  switch (haversine_err) {
+    case NO_ERR_HAVERSINE_ERR_TYPE:
+      return "no error";
+    case NULL_POINTER_HAVERSINE_ERR_TYPE:
+      return "null pointer";
+    case FILE_IO_HAVERSINE_ERR_TYPE:
+      return "file i/o";
+    case PARSE_HAVERSINE_ERR_TYPE:
+      return "parse";
+    case MEM_ALLOC_HAVERSINE_ERR_TYPE:
+      return "memory allocation";
+    case INVALID_INPUT_HAVERSINE_ERR_TYPE:
+      return "invalid input";
+    case TOLERANCE_EXCEEDED_HAVERSINE_ERR_TYPE:
+      return "tolerance exceeded";
+    default:
+      return "unknown error code";
+  }
+}
+
+/*
+ * Reads the whole file into a malloc'd, '\0'-terminated buffer.
+ * Caller frees the result.
+ */
+char* haversine_read_file(const char* path, u64* len, i32* err) {
+  FILE* file = fopen(path, "rb");
+  if (!file) {
+    *err = FILE_IO_HAVERSINE_ERR_TYPE;
+    return 0;
+  }
+  // off_t is 64-bit, long is not on every platform
+  fseeko(file, 0, SEEK_END);
+  const off_t file_len = ftello(file);
+  fseeko(file, 0, SEEK_SET);
+  if (file_len < 0) {
+    fclose(file);
+    *err = FILE_IO_HAVERSINE_ERR_TYPE;
+    return 0;
+  }
+
+  char* buf = malloc((size_t)file_len + 1);
+  if (!buf) {
+    fclose(file);
+    *err = MEM_ALLOC_HAVERSINE_ERR_TYPE;
+    return 0;
+  }
+  const size_t read_len = fread(buf, 1, (size_t)file_len, file);
+  fclose(file);
+  if (read_len != (size_t)file_len) {
+    free(buf);
+    *err = FILE_IO_HAVERSINE_ERR_TYPE;
+    return 0;
+  }
+  buf[file_len] = '\0';
+  *len          = (u64)file_len;
+  return buf;
+}
+
+i32 haversine_alloc_pairs(HaversinePairs* pairs, const u32 count,
+                          SimpleArena* arena) {
+  // every column starts on its own cache line, for aligned vector loads
+  const u64 size      = count * sizeof(f64);
+  const u64 align     = ARENA_CACHE_LINE;
+  i32       arena_err = 0;
+  pairs->x0           = alloc_arena_aligned(arena, size, align, &arena_err);
+  pairs->y0           = alloc_arena_aligned(arena, size, align, &arena_err);
+  pairs->x1           = alloc_arena_aligned(arena, size, align, &arena_err);
+  pairs->y1           = alloc_arena_aligned(arena, size, align, &arena_err);
+  pairs->count        = count;
+  return arena_err ? MEM_ALLOC_HAVERSINE_ERR_TYPE : NO_ERR_HAVERSINE_ERR_TYPE;
+}
+
+i32 haversine_alloc_pairs32(HaversinePairs32* pairs, const u32 count,
+                            SimpleArena* arena) {
+  // every column starts on its own cache line, for aligned vector loads
+  const u64 size      = count * sizeof(f32);
+  const u64 align     = ARENA_CACHE_LINE;
+  i32       arena_err = 0;
+  pairs->x0           = alloc_arena_aligned(arena, size, align, &arena_err);
+  pairs->y0           = alloc_arena_aligned(arena, size, align, &arena_err);
+  pairs->x1           = alloc_arena_aligned(arena, size, align, &arena_err);
+  pairs->y1           = alloc_arena_aligned(arena, size, align, &arena_err);
+  pairs->count        = count;
+  return arena_err ? MEM_ALLOC_HAVERSINE_ERR_TYPE : NO_ERR_HAVERSINE_ERR_TYPE;
+}
+
+/*
+ * Parses one `{"x0": f, "x1": f, "y0": f, "y1": f}` object (any key order)
+ * starting at or after `at`. Returns the position after the last value, or 0
+ * on malformed input.
+ */
+char* haversine_parse_pair(char* at, f64* x0, f64* y0, f64* x1, f64* y1) {
+  at = strchr(at, '{');
+  if (!at) {
+    return 0;
+  }
+  at++;
+  for (u32 field = 0; field < 4; field++) {
+    at = strchr(at, '"');
+    if (!at || at[1] == '\0' || at[2] == '\0' || at[3] != '"') {
+      return 0;
+    }
+    const char axis  = at[1];
+    const char point = at[2];
+    at               = strchr(at + 4, ':');
+    if (!at) {
+      return 0;
+    }
+    char*     end = 0;
+    const f64 val = strtod(at + 1, &end);
+    if (end == at + 1) {
+      return 0;
+    }
+    at = end;
+
+    if (axis == 'x' && point == '0') {
+      *x0 = val;
+    } else if (axis == 'x' && point == '1') {
+      *x1 = val;
+    } else if (axis == 'y' && point == '0') {
+      *y0 = val;
+    } else if (axis == 'y' && point == '1') {
+      *y1 = val;
+    } else {
+      return 0;
+    }
+  }
+  return at;
+}
+
+/*
+ * Return the position right after the '[' of the "pairs" array, with close
+ * set to ']'. Input without a "pairs" key is NDJSON, one pair object per
+ * line: that starts at the beginning and closes at the end ('\0'). It has to
+ * open with a well-formed pair, so that other text is rejected instead of
+ * being scanned as NDJSON that holds no pairs. Blank input is empty NDJSON.
+ */
+static char* haversine_pairs_begin(char* json, const u64 len, char* close,
+                                   i32* err) {
+  char* at = strstr(json, "\"pairs\"");
+  if (!at) {
+    const char* first = json + strspn(json, " \t\r\n");
+    f64         x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+    char*       end =
+        *first == '{' ? haversine_parse_pair(json, &x0, &y0, &x1, &y1) : 0;
+    if (first != json + len &&
+        (!end || end[strspn(end, " \t\r\n")] != '}')) {
+      *err = PARSE_HAVERSINE_ERR_TYPE;
+      return 0;
+    }
+    *close = '\0';
+    return json;
+  }
+  if (!(at = strchr(at, '['))) {
+    *err = PARSE_HAVERSINE_ERR_TYPE;
+    return 0;
+  }
+  *close = ']';
+  return at + 1;
+}
+
+/*
+ * `{"x0":0,"y0":0,"x1":0,"y1":0}`, the shortest a pair object can be, so an
+ * input of len bytes holds at most len / HAVERSINE_MIN_PAIR_LEN pairs.
+ */
+#define HAVERSINE_MIN_PAIR_LEN 29
+
+typedef struct HaversinePairRow {
+  f64 x0;
+  f64 y0;
+  f64 x1;
+  f64 y1;
+} HaversinePairRow;
+
+typedef struct HaversinePairRows {
+  HaversinePairRow* items;
+  u64               count;
+  u64               capacity;
+} HaversinePairRows;
+
+/*
+ * Parses every object of the "pairs" array into columns allocated from the
+ * arena, in a single pass over the text.
+ *
+ * The count is only known at the end, so the pairs are first collected as
+ * rows in a scratch arena of their own, where they always grow in place.
+ * Four columns growing side by side would copy three of them on every
+ * doubling. json_len, the length of json, sizes that scratch arena.
+ */
+i32 haversine_parse_pairs(char* json, const u64 json_len, SimpleArena* arena,
+                          HaversinePairs* pairs) {
+  i32   err   = 0;
+  char  close = 0;
+  char* at    = haversine_pairs_begin(json, json_len, &close, &err);
+  if (!at) {
+    return err;
+  }
+  // json_len bounds the rows, doubling can take the capacity to twice that
+  const u64 max_rows = json_len / HAVERSINE_MIN_PAIR_LEN + 1;
+  const u64 reserve =
+      (2 * max_rows + ARENA_DA_INIT_CAP) * sizeof(HaversinePairRow);
+  SimpleArena* scratch = init_virtual_arena(reserve, 0, &err);
+  if (err) {
+    return MEM_ALLOC_HAVERSINE_ERR_TYPE;
+  }
+  HaversinePairRows rows = {0};
+  for (;;) {
+    while (*at != '\0' && *at != '{' && *at != close) {
+      at++;
+    }
+    if (*at != '{') {
+      break;
+    }
+    HaversinePairRow row = {0};
+    at = haversine_parse_pair(at, &row.x0, &row.y0, &row.x1, &row.y1);
+    if (!at) {
+      free_arena(scratch);
+      return PARSE_HAVERSINE_ERR_TYPE;
+    }
+    arena_da_append(scratch, &rows, row, &err);
+    if (err) {
+      free_arena(scratch);
+      return MEM_ALLOC_HAVERSINE_ERR_TYPE;
+    }
+  }
+  if (*at != close) {
+    free_arena(scratch);
+    return PARSE_HAVERSINE_ERR_TYPE;
+  }
+  // in-memory columns are indexed with u32, larger inputs have to be streamed
+  if (rows.count > (u32)-1) {
+    free_arena(scratch);
+    return INVALID_INPUT_HAVERSINE_ERR_TYPE;
+  }
+
+  err = haversine_alloc_pairs(pairs, (u32)rows.count, arena);
+  for (u32 i = 0; !err && i < pairs->count; i++) {
+    pairs->x0[i] = rows.items[i].x0;
+    pairs->y0[i] = rows.items[i].y0;
+    pairs->x1[i] = rows.items[i].x1;
+    pairs->y1[i] = rows.items[i].y1;
+  }
+  print_arena_stats(scratch, "parse scratch");
+  free_arena(scratch);
+  return err;
+}
+
+/*
+ * Streaming reader
+ *
+ * Reads the input in fixed blocks and parses it into a fixed batch of
+ * columns, so memory does not depend on the input size. A block always ends
+ * on a whole object: the unparsed tail is moved to the front before the next
+ * read. The "pairs" key has to appear in the first block, otherwise the
+ * input is read as NDJSON.
+ */
+#define HAVERSINE_STREAM_BLOCK_SIZE (1 << 20)
+#define HAVERSINE_STREAM_BATCH_PAIRS 4096
+
+typedef struct HaversinePairStream {
+  FILE*          file;
+  char*          buf;
+  u64            len;
+  u64            at;
+  char           close;
+  i32            done;
+  HaversinePairs batch;
+} HaversinePairStream;
+
+/*
+ * Moves the unparsed tail to the front and fills the rest of the block.
+ * Returns 0 once the file has nothing left.
+ */
+static i32 haversine_stream_refill(HaversinePairStream* stream) {
+  const u64 tail = stream->len - stream->at;
+  memmove(stream->buf, stream->buf + stream->at, tail);
+  stream->len = tail + fread(stream->buf + tail, 1,
+                             HAVERSINE_STREAM_BLOCK_SIZE - tail, stream->file);
+  stream->at  = 0;
+  stream->buf[stream->len] = '\0';
+  return stream->len > tail;
+}
+
+void haversine_close_pair_stream(HaversinePairStream* stream) {
+  if (stream->file) {
+    fclose(stream->file);
+  }
+  stream->file = 0;
+}
+
+/*
+ * The block and the batch columns come from the arena, close the stream with
+ * haversine_close_pair_stream().
+ */
+i32 haversine_open_pair_stream(const char* path, HaversinePairStream* stream,
+                               SimpleArena* arena) {
+  *stream    = (HaversinePairStream){0};
+  i32 err    = 0;
+  stream->buf = alloc_arena(arena, HAVERSINE_STREAM_BLOCK_SIZE + 1, &err);
+  if (err ||
+      haversine_alloc_pairs(&stream->batch, HAVERSINE_STREAM_BATCH_PAIRS,
+                            arena)) {
+    return MEM_ALLOC_HAVERSINE_ERR_TYPE;
+  }
+  stream->file = fopen(path, "rb");
+  if (!stream->file) {
+    return FILE_IO_HAVERSINE_ERR_TYPE;
+  }
+  haversine_stream_refill(stream);
+  char* at =
+      haversine_pairs_begin(stream->buf, stream->len, &stream->close, &err);
+  if (!at) {
+    haversine_close_pair_stream(stream);
+    return err;
+  }
+  stream->at = (u64)(at - stream->buf);
+  return NO_ERR_HAVERSINE_ERR_TYPE;
+}
+
+/*
+ * Parses up to HAVERSINE_STREAM_BATCH_PAIRS pairs into stream->batch and
+ * returns how many, 0 after the closing ']' or the end of an NDJSON input.
+ * A truncated input or an object
+ * larger than a block is a parse error.
+ */
+u32 haversine_next_pairs(HaversinePairStream* stream, i32* err) {
+  HaversinePairs* batch = &stream->batch;
+  batch->count          = 0;
+  while (!stream->done && batch->count < HAVERSINE_STREAM_BATCH_PAIRS) {
+    while (stream->at < stream->len &&
+           (stream->buf[stream->at] == ',' ||
+            isspace((unsigned char)stream->buf[stream->at]))) {
+      stream->at++;
+    }
+    if (stream->at == stream->len) {
+      if (!haversine_stream_refill(stream)) {
+        stream->done = stream->close == '\0';
+        if (!stream->done) {
+          *err = PARSE_HAVERSINE_ERR_TYPE;
+          return 0;
+        }
+      }
+      continue;
+    }
+    char* object = stream->buf + stream->at;
+    if (*object == stream->close) {
+      stream->done = 1;
+      break;
+    }
+    char* close =
+        *object == '{' ? memchr(object, '}', stream->len - stream->at) : 0;
+    if (*object == '{' && !close) {
+      if (stream->at == 0 || !haversine_stream_refill(stream)) {
+        *err = PARSE_HAVERSINE_ERR_TYPE;
+        return 0;
+      }
+      continue;
+    }
+    const u32 i   = batch->count;
+    char*     end = close ? haversine_parse_pair(object, &batch->x0[i],
+                                                 &batch->y0[i], &batch->x1[i],
+                                                 &batch->y1[i])
+                          : 0;
+    if (!end || end > close) {
+      *err = PARSE_HAVERSINE_ERR_TYPE;
+      return 0;
+    }
+    batch->count++;
+    stream->at = (u64)(close + 1 - stream->buf);
+  }
+  return batch->count;
+}
+
+/*
+ * Narrow f64 columns to f32. The generator emits 6 decimals, which f32 holds
+ * to within ~1e-5 degrees (~1 m) over the whole coordinate range.
+ */
+i32 haversine_pairs_to_f32(const HaversinePairs* src, HaversinePairs32* dst,
+                           SimpleArena* arena) {
+  const i32 err = haversine_alloc_pairs32(dst, src->count, arena);
+  if (err) {
+    return err;
+  }
+  for (u32 i = 0; i < src->count; i++) {
+    dst->x0[i] = (f32)src->x0[i];
+    dst->y0[i] = (f32)src->y0[i];
+    dst->x1[i] = (f32)src->x1[i];
+    dst->y1[i] = (f32)src->y1[i];
+  }
+  return NO_ERR_HAVERSINE_ERR_TYPE;
+}
+
+#endif  // _BG_HAVERSINE_PAIRS_C
@@ -0,0 +1,782 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "arena.c"
+#include "haversine_binary.c"
+#include "haversine_index.c"
+#include "haversine_kernel.c"
+#include "haversine_matrix.c"
+#include "haversine_packed.c"
+#include "haversine_pairs.c"
+#include "haversine_sample.c"
+#include "haversine_stats.c"
+#include "haversine_unit.c"
+#include "haversine_verify.c"
+
+typedef unsigned int       u32;
+typedef unsigned long long u64;
+typedef int                i32;
+typedef double             f64;
+
+extern const f64 REF_EARTH_RADIUS_KM;
+
+// kilometre-level accuracy is what the f32 consumers ask for
+static const f64 default_f32_tolerance_km = 1.0;
+static const u64 default_max_samples      = 1 << 24;
+static const u64 default_sample_seed      = 0x5EED;
+
+enum ProcessKernel {
+  F64_PROCESS_KERNEL = 0,
+  F32_PROCESS_KERNEL,
+  UNIT_PROCESS_KERNEL,
+};
+
+typedef struct ProcessOptions {
+  const char*        input_filename;
+  const char*        answer_filename;
+  const char*        answers_f64_filename;
+  enum ProcessKernel kernel;
+  i32                nearest;
+  i32                count_within;
+  f64                within_km;
+  i32                radius_query;
+  i32                knn_query;
+  f64                query_lon;
+  f64                query_lat;
+  f64                query_radius_km;
+  u32                query_k;
+  u32                top_k;
+  i32                distribution;
+  u32                num_threads;
+  f64                sample_tolerance;
+  f64                f32_tolerance_km;
+  i32                stream;
+  i32                no_cache;
+  const char*        pack_filename;
+  u32                arena_flags;
+} ProcessOptions;
+
+static void print_usage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [--f32 | --unit] [--tolerance KM] [--verify ANSWERS_F64] "
+          "[--nearest] [--within KM] [--radius LON LAT KM] [--knn LON LAT K] "
+          "[--top K] [--distribution] [--threads N] [--sample REL_TOLERANCE] "
+          "[--stream] [--no-cache] [--pack OUTPUT] [--huge-pages | --hugetlb] "
+          "[--prefault] INPUT [ANSWER_FILE]\n"
+          "Without --stream or --sample the whole input is held in memory, "
+          "fewer than 2^32 pairs. --stream reads it in constant memory but "
+          "only computes the f64 average; --sample estimates it from random "
+          "reads.\n",
+          program);
+}
+
+static i32 parse_options(int argc, char** argv, ProcessOptions* options) {
+  *options = (ProcessOptions){.f32_tolerance_km = default_f32_tolerance_km,
+                              .num_threads      = 1};
+  for (i32 i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--f32") == 0) {
+      options->kernel = F32_PROCESS_KERNEL;
+    } else if (strcmp(argv[i], "--unit") == 0) {
+      options->kernel = UNIT_PROCESS_KERNEL;
+    } else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) {
+      options->f32_tolerance_km = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--verify") == 0 && i + 1 < argc) {
+      options->answers_f64_filename = argv[++i];
+    } else if (strcmp(argv[i], "--nearest") == 0) {
+      options->nearest = 1;
+    } else if (strcmp(argv[i], "--within") == 0 && i + 1 < argc) {
+      options->count_within = 1;
+      options->within_km    = atof(argv[++i]);
+      if (options->within_km < 0) {
+        fprintf(stderr, "--within needs a distance >= 0\n");
+        return 0;
+      }
+    } else if (strcmp(argv[i], "--radius") == 0 && i + 3 < argc) {
+      options->radius_query    = 1;
+      options->query_lon       = atof(argv[++i]);
+      options->query_lat       = atof(argv[++i]);
+      options->query_radius_km = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--knn") == 0 && i + 3 < argc) {
+      options->knn_query = 1;
+      options->query_lon = atof(argv[++i]);
+      options->query_lat = atof(argv[++i]);
+      options->query_k   = (u32)atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--top") == 0 && i + 1 < argc) {
+      options->top_k = (u32)atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--distribution") == 0) {
+      options->distribution = 1;
+    } else if (strcmp(argv[i], "--sample") == 0 && i + 1 < argc) {
+      options->sample_tolerance = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--stream") == 0) {
+      options->stream = 1;
+    } else if (strcmp(argv[i], "--no-cache") == 0) {
+      options->no_cache = 1;
+    } else if (strcmp(argv[i], "--pack") == 0 && i + 1 < argc) {
+      options->pack_filename = argv[++i];
+    } else if (strcmp(argv[i], "--huge-pages") == 0) {
+      options->arena_flags |= HUGE_PAGES_ARENA_FLAG;
+    } else if (strcmp(argv[i], "--hugetlb") == 0) {
+      options->arena_flags |= HUGETLB_ARENA_FLAG;
+    } else if (strcmp(argv[i], "--prefault") == 0) {
+      options->arena_flags |= PREFAULT_ARENA_FLAG;
+    } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      const i32 num_threads = atoi(argv[++i]);
+      options->num_threads  = num_threads > 0 ? (u32)num_threads : 1;
+    } else if (!options->input_filename) {
+      options->input_filename = argv[i];
+    } else if (!options->answer_filename) {
+      options->answer_filename = argv[i];
+    } else {
+      return 0;
+    }
+  }
+  return options->input_filename != 0;
+}
+
+static i32 read_answer(const char* filename, f64* answer) {
+  FILE* file = fopen(filename, "r");
+  if (!file) {
+    return 0;
+  }
+  const i32 matched = fscanf(file, "%lf", answer);
+  fclose(file);
+  return matched == 1;
+}
+
+/*
+ * Runs the selected kernel per pair and compares every distance with the
+ * binary answers written by haversine_gen.
+ */
+static i32 verify_kernel(const ProcessOptions*      options,
+                         const HaversinePairs*      pairs,
+                         const HaversinePairs32*    pairs32,
+                         const HaversineUnitPoints* points0,
+                         const HaversineUnitPoints* points1,
+                         SimpleArena*               arena) {
+  HaversineAnswers answers = {0};
+  i32 err = haversine_read_answers(options->answers_f64_filename, &answers);
+  if (err) {
+    fprintf(stderr, "Could not read %s (err %2d: %s)\n",
+            options->answers_f64_filename, err, haversine_err_to_cstr(err));
+    return 0;
+  }
+  if (answers.count != pairs->count) {
+    fprintf(stderr, "Answers hold %u pairs, input holds %u\n", answers.count,
+            pairs->count);
+    haversine_free_answers(&answers);
+    return 0;
+  }
+
+  f64* distances = alloc_arena(arena, pairs->count * sizeof(f64), &err);
+  if (err) {
+    fprintf(stderr, "Could not allocate distances (err %2d)\n", err);
+    haversine_free_answers(&answers);
+    return 0;
+  }
+  switch (options->kernel) {
+    case F32_PROCESS_KERNEL:
+      haversine_distances_f32(pairs32, (f32)REF_EARTH_RADIUS_KM, distances);
+      break;
+    case UNIT_PROCESS_KERNEL:
+      haversine_distances_unit(points0, points1, REF_EARTH_RADIUS_KM,
+                               distances);
+      break;
+    default:
+      haversine_distances_f64(pairs, REF_EARTH_RADIUS_KM, distances);
+      break;
+  }
+
+  HaversineVerifyReport report = {0};
+  haversine_verify_distances(distances, &answers, &report);
+  haversine_print_verify_report(&report, &answers);
+  haversine_free_answers(&answers);
+  return 1;
+}
+
+/*
+ * All start points against all end points of the input.
+ */
+static i32 run_matrix_queries(const ProcessOptions*      options,
+                              const HaversineUnitPoints* points0,
+                              const HaversineUnitPoints* points1,
+                              SimpleArena*               arena) {
+  i32       err     = 0;
+  const u64 scratch = checkpoint_arena(arena);
+  if (options->nearest) {
+    f64* min_distance =
+        alloc_arena(arena, points0->count * sizeof(f64), &err);
+    u32* min_idx = alloc_arena(arena, points0->count * sizeof(u32), &err);
+    if (err) {
+      fprintf(stderr, "Could not allocate row minima (err %2d)\n", err);
+      return 0;
+    }
+    haversine_matrix_row_min(points0, points1, REF_EARTH_RADIUS_KM,
+                             min_distance, min_idx);
+    f64 sum = 0;
+    for (u32 r = 0; r < points0->count; r++) {
+      sum += min_distance[r];
+    }
+    printf("Nearest    : %.16f avg km to the closest end point\n",
+           sum / points0->count);
+    rewind_arena(arena, scratch);
+  }
+  if (options->count_within) {
+    u32* counts = alloc_arena(arena, points0->count * sizeof(u32), &err);
+    if (err) {
+      fprintf(stderr, "Could not allocate row counts (err %2d)\n", err);
+      return 0;
+    }
+    const u64 total = haversine_matrix_count_within(
+        points0, points1, REF_EARTH_RADIUS_KM, options->within_km, counts);
+    printf("Within     : %llu start/end combinations within %f km\n", total,
+           options->within_km);
+  }
+  return 1;
+}
+
+/*
+ * Grid index over the start points of the input.
+ */
+static i32 run_index_queries(const ProcessOptions* options,
+                             const HaversinePairs* pairs, SimpleArena* arena) {
+  HaversineGridIndex index = {0};
+  i32 err = haversine_build_grid_index(pairs->x0, pairs->y0, pairs->count,
+                                       REF_EARTH_RADIUS_KM, arena, &index);
+  if (err) {
+    fprintf(stderr, "Could not build grid index (err %2d: %s)\n", err,
+            haversine_err_to_cstr(err));
+    return 0;
+  }
+
+  if (options->radius_query) {
+    const u32 found =
+        haversine_grid_within(&index, options->query_lon, options->query_lat,
+                              options->query_radius_km, 0, 0);
+    printf("Radius     : %u start points within %f km of (%f, %f)\n", found,
+           options->query_radius_km, options->query_lon, options->query_lat);
+  }
+  if (options->knn_query) {
+    u32* ids       = alloc_arena(arena, options->query_k * sizeof(u32), &err);
+    f64* distances = alloc_arena(arena, options->query_k * sizeof(f64), &err);
+    if (err) {
+      fprintf(stderr, "Could not allocate %u neighbours (err %2d)\n",
+              options->query_k, err);
+      return 0;
+    }
+    const u32 found =
+        haversine_grid_nearest(&index, options->query_lon, options->query_lat,
+                               options->query_k, ids, distances);
+    printf("Nearest %u start points to (%f, %f):\n", found,
+           options->query_lon, options->query_lat);
+    for (u32 i = 0; i < found; i++) {
+      printf("  pair %10u : %.6f km\n", ids[i], distances[i]);
+    }
+  }
+  return 1;
+}
+
+// one cache line or more per worker, so writing back never false-shares
+typedef struct StatsWorker {
+  _Alignas(ARENA_CACHE_LINE) const HaversinePairs* pairs;
+  u32                   begin;
+  u32                   end;
+  u32                   top_k;
+  ArenaSupplier*        supplier;
+  i32                   err;
+  HaversineStats        stats;
+} StatsWorker;
+
+static void* run_stats_worker(void* arg) {
+  StatsWorker* worker = arg;
+  // the top-k heaps take a push per pair, keep them on blocks of our own
+  i32          arena_err = 0;
+  SimpleArena* arena     = init_thread_arena(worker->supplier, &arena_err);
+  if (arena_err) {
+    worker->err = MEM_ALLOC_HAVERSINE_ERR_TYPE;
+    return 0;
+  }
+  worker->err = haversine_init_stats(&worker->stats, worker->top_k,
+                                     REF_EARTH_RADIUS_KM, arena);
+  if (worker->err) {
+    return 0;
+  }
+  // accumulate on the stack, the slot is only written once at the end
+  HaversineStats stats = worker->stats;
+  haversine_accumulate_stats(worker->pairs, worker->begin, worker->end,
+                             REF_EARTH_RADIUS_KM, &stats);
+  worker->stats = stats;
+  return 0;
+}
+
+static void print_topk(const char* label, const HaversineTopK* topk) {
+  printf("%s %u pairs:\n", label, topk->size);
+  for (u32 i = 0; i < topk->size; i++) {
+    printf("  pair %10u : %.6f km\n", topk->ids[i],
+           haversine_topk_distance(topk, i));
+  }
+}
+
+static void print_distribution(const HaversineStats* stats) {
+  if (!stats->count) {
+    printf("Distribution: no pairs\n");
+    return;
+  }
+  printf("Min        : %.6f km\n", stats->min);
+  printf("Max        : %.6f km\n", stats->max);
+  printf("p50        : %.6f km\n",
+         haversine_sketch_quantile(&stats->sketch, 0.50));
+  printf("p90        : %.6f km\n",
+         haversine_sketch_quantile(&stats->sketch, 0.90));
+  printf("p99        : %.6f km\n",
+         haversine_sketch_quantile(&stats->sketch, 0.99));
+  printf("Histogram (%.1f km buckets):\n", stats->histogram_width);
+  for (u32 i = 0; i < HAVERSINE_HISTOGRAM_BUCKETS; i++) {
+    if (stats->histogram[i]) {
+      printf("  [%8.1f, %8.1f) : %llu\n", i * stats->histogram_width,
+             (i + 1) * stats->histogram_width, stats->histogram[i]);
+    }
+  }
+}
+
+/*
+ * Address space for the main arena, only committed as it gets used. No
+ * combination of options needs more than 256 bytes per pair; on top of that
+ * come the grid's cell table, the query results, the stats workers and
+ * alignment padding.
+ */
+static u64 process_arena_reserve(const ProcessOptions* options,
+                                 const u64             count) {
+  const u64 grid_cells = (u64)1 << (2 * HAVERSINE_GRID_MAX_BITS);
+  return count * 256 + (grid_cells + 1) * sizeof(u32) +
+         (u64)options->query_k * (sizeof(u32) + sizeof(f64)) +
+         (u64)options->num_threads * (sizeof(StatsWorker) + sizeof(pthread_t)) +
+         ARENA_COMMIT_GRANULE;
+}
+
+/*
+ * One streaming pass over the pairs, split into equal ranges per thread.
+ * Every worker fills its own HaversineStats, which are merged afterwards.
+ */
+static i32 run_stats_pass(const ProcessOptions* options,
+                          const HaversinePairs* pairs, SimpleArena* arena) {
+  i32          err     = 0;
+  const u32    workers = options->num_threads;
+  StatsWorker* worker  = alloc_arena_aligned(
+      arena, workers * sizeof(StatsWorker), _Alignof(StatsWorker), &err);
+  pthread_t* threads = alloc_arena(arena, workers * sizeof(pthread_t), &err);
+  // a worker claims its first block and at most one refill for each of its
+  // four top-k arrays; blocks are 2 MB at most, with huge pages
+  const u64 topk_bytes =
+      2 * (u64)options->top_k * (sizeof(f64) + sizeof(u32));
+  const u64      reserve  = workers * (topk_bytes + 6 * ARENA_HUGE_PAGE_SIZE);
+  ArenaSupplier* supplier =
+      err ? 0
+          : init_arena_supplier(reserve, ARENA_DEFAULT_BLOCK_SIZE,
+                                options->arena_flags, &err);
+  if (err) {
+    fprintf(stderr, "Could not allocate workers (err %2d)\n", err);
+    return 0;
+  }
+  for (u32 t = 0; t < workers; t++) {
+    worker[t] = (StatsWorker){
+        .pairs    = pairs,
+        .begin    = (u32)((u64)pairs->count * t / workers),
+        .end      = (u32)((u64)pairs->count * (t + 1) / workers),
+        .top_k    = options->top_k,
+        .supplier = supplier,
+    };
+  }
+  // if a thread cannot be created, its range and the ones after it run here
+  u32 started = 1;
+  for (; started < workers; started++) {
+    if (pthread_create(&threads[started], 0, run_stats_worker,
+                       &worker[started])) {
+      break;
+    }
+  }
+  run_stats_worker(&worker[0]);
+  for (u32 t = started; t < workers; t++) {
+    run_stats_worker(&worker[t]);
+  }
+  for (u32 t = 1; t < started; t++) {
+    pthread_join(threads[t], 0);
+  }
+  for (u32 t = 0; t < workers; t++) {
+    if (worker[t].err) {
+      fprintf(stderr, "Could not allocate stats (err %2d: %s)\n",
+              worker[t].err, haversine_err_to_cstr(worker[t].err));
+      free_arena_supplier(supplier);
+      return 0;
+    }
+    if (t) {
+      haversine_merge_stats(&worker[0].stats, &worker[t].stats);
+    }
+  }
+
+  HaversineStats* stats = &worker[0].stats;
+  printf("Stats avg  : %.16f (%u threads)\n", stats->sum / stats->count,
+         workers);
+  if (options->distribution) {
+    print_distribution(stats);
+  }
+  if (options->top_k) {
+    haversine_topk_sort(&stats->farthest);
+    haversine_topk_sort(&stats->nearest);
+    print_topk("Farthest", &stats->farthest);
+    print_topk("Nearest", &stats->nearest);
+  }
+  free_arena_supplier(supplier);
+  return 1;
+}
+
+/*
+ * Estimates the average from random reads instead of loading the input.
+ */
+static i32 run_sampling(const ProcessOptions* options) {
+  // random byte offsets only resynchronise on text records
+  HaversineBinaryHeader header = {0};
+  HaversinePackedFile   packed = {0};
+  if (!haversine_read_binary_header(options->input_filename, &header)) {
+    fprintf(stderr, "--sample reads JSON or NDJSON input\n");
+    return 0;
+  }
+  if (!haversine_map_packed(options->input_filename, &packed)) {
+    haversine_unmap_packed(&packed);
+    fprintf(stderr, "--sample reads JSON or NDJSON input\n");
+    return 0;
+  }
+  HaversineSampleResult result = {0};
+  const i32             err    = haversine_sample_average(
+      options->input_filename, options->sample_tolerance, default_max_samples,
+      default_sample_seed, REF_EARTH_RADIUS_KM, &result);
+  if (err) {
+    fprintf(stderr, "Could not sample %s (err %2d: %s)\n",
+            options->input_filename, err, haversine_err_to_cstr(err));
+    return 0;
+  }
+  printf("Input size : %llu\n", result.file_size);
+  printf("Samples    : %llu (%llu bytes read, %.4f%% of the input)\n",
+         result.samples, result.bytes_read,
+         100.0 * result.bytes_read / result.file_size);
+  printf("Haversine  : %.16f +- %.16f (95%% confidence)\n", result.mean,
+         result.half_width);
+  if (options->answer_filename) {
+    f64 answer = 0;
+    if (!read_answer(options->answer_filename, &answer)) {
+      fprintf(stderr, "Could not read answer from %s\n",
+              options->answer_filename);
+      return 0;
+    }
+    printf("Reference  : %.16f\n", answer);
+    printf("Difference : %.16f\n", result.mean - answer);
+  }
+  return 1;
+}
+
+/*
+ * Exact f64 average in fixed memory: the input is parsed block by block and
+ * never held whole, so the pair count is only limited by the u64 counter.
+ */
+static i32 run_streaming(const ProcessOptions* options) {
+  if (options->kernel != F64_PROCESS_KERNEL || options->answers_f64_filename ||
+      options->nearest || options->count_within || options->radius_query ||
+      options->knn_query || options->top_k || options->distribution) {
+    fprintf(stderr, "--stream only computes the f64 average\n");
+    return 0;
+  }
+  i32          err   = 0;
+  SimpleArena* arena = init_arena(
+      HAVERSINE_STREAM_BLOCK_SIZE + 1 +
+          4 * (HAVERSINE_STREAM_BATCH_PAIRS * sizeof(f64) + ARENA_CACHE_LINE),
+      options->arena_flags, &err);
+  if (err) {
+    fprintf(stderr, "Could not allocate arena (err %2d)\n", err);
+    return 0;
+  }
+  u64                  count  = 0;
+  f64                  sum    = 0;
+  HaversineMappedPairs mapped = {0};
+  HaversinePackedFile  packed = {0};
+  if (!haversine_map_binary_columns(options->input_filename, &mapped)) {
+    // batch-sized slices of the mapped columns, read once front to back
+    madvise(mapped.map, mapped.size, MADV_SEQUENTIAL);
+    for (u64 begin = 0; begin < mapped.count;
+         begin += HAVERSINE_STREAM_BATCH_PAIRS) {
+      const u64            left  = mapped.count - begin;
+      const HaversinePairs slice = haversine_mapped_slice(
+          &mapped, begin,
+          left < HAVERSINE_STREAM_BATCH_PAIRS ? (u32)left
+                                              : HAVERSINE_STREAM_BATCH_PAIRS);
+      sum += haversine_sum_f64(&slice, REF_EARTH_RADIUS_KM);
+      count += slice.count;
+    }
+    haversine_unmap_pairs(&mapped);
+  } else if (!haversine_map_packed(options->input_filename, &packed)) {
+    // decoded one block at a time, straight into the kernel's batch
+    HaversinePairs batch = {0};
+    err = haversine_alloc_pairs(&batch, HAVERSINE_PACK_BLOCK_PAIRS, arena);
+    for (u64 b = 0; !err && b < packed.header->block_count; b++) {
+      haversine_unpack_block(&packed, b, &batch);
+      sum += haversine_sum_f64(&batch, REF_EARTH_RADIUS_KM);
+      count += batch.count;
+    }
+    haversine_unmap_packed(&packed);
+  } else {
+    HaversinePairStream stream = {0};
+    err = haversine_open_pair_stream(options->input_filename, &stream, arena);
+    while (!err && haversine_next_pairs(&stream, &err)) {
+      sum += haversine_sum_f64(&stream.batch, REF_EARTH_RADIUS_KM);
+      count += stream.batch.count;
+    }
+    haversine_close_pair_stream(&stream);
+  }
+  print_arena_stats(arena, "stream");
+  free_arena(arena);
+  if (err) {
+    fprintf(stderr, "Could not stream %s (err %2d: %s)\n",
+            options->input_filename, err, haversine_err_to_cstr(err));
+    return 0;
+  }
+  if (!count) {
+    fprintf(stderr, "No pairs found in %s\n", options->input_filename);
+    return 0;
+  }
+
+  const f64 avg = sum / count;
+  printf("Pair count : %llu\n", count);
+  printf("Haversine  : %.16f\n", avg);
+  if (options->answer_filename) {
+    f64 answer = 0;
+    if (!read_answer(options->answer_filename, &answer)) {
+      fprintf(stderr, "Could not read answer from %s\n",
+              options->answer_filename);
+      return 0;
+    }
+    printf("Reference  : %.16f\n", answer);
+    printf("Difference : %.16f\n", avg - answer);
+  }
+  return 1;
+}
+
+int main(int argc, char** argv) {
+  ProcessOptions options = {0};
+  if (!parse_options(argc, argv, &options)) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (options.sample_tolerance > 0) {
+    return run_sampling(&options) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  if (options.stream) {
+    return run_streaming(&options) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  // binary inputs and fresh parse caches are mapped, packed inputs decoded,
+  // text is loaded whole
+  HaversineBinaryHeader header = {0};
+  HaversineMappedPairs  mapped = {0};
+  HaversinePackedFile   packed = {0};
+  char*                 json   = 0;
+  SimpleArena*          arena  = 0;
+  const i32 binary = !haversine_read_binary_header(options.input_filename,
+                                                   &header);
+  i32       err    = 0;
+  if (binary) {
+    err = haversine_map_binary(options.input_filename, &mapped);
+  } else if (!haversine_map_packed(options.input_filename, &packed)) {
+    printf("Packed     : %llu blocks\n", packed.header->block_count);
+  } else if (!options.no_cache &&
+             !haversine_map_cache(options.input_filename, &mapped)) {
+    printf("Parse cache: %s%s\n", options.input_filename,
+           HAVERSINE_CACHE_SUFFIX);
+  }
+  if (err == INVALID_INPUT_HAVERSINE_ERR_TYPE) {
+    fprintf(stderr, "Too many pairs to hold in memory (%llu), use --stream\n",
+            header.count);
+    goto failed;
+  }
+  if (err) {
+    fprintf(stderr, "Could not map %s (err %2d: %s)\n",
+            options.input_filename, err, haversine_err_to_cstr(err));
+    goto failed;
+  }
+  u64 json_len = mapped.map ? mapped.size : packed.size;
+  if (!mapped.map && !packed.map) {
+    json = haversine_read_file(options.input_filename, &json_len, &err);
+    if (err) {
+      fprintf(stderr, "Could not read %s (err %2d: %s)\n",
+              options.input_filename, err, haversine_err_to_cstr(err));
+      goto failed;
+    }
+  }
+
+  // text is only counted while it is parsed, until then its length bounds
+  // the count
+  const u64 count = mapped.map   ? mapped.pairs.count
+                    : packed.map ? packed.header->count
+                                 : json_len / HAVERSINE_MIN_PAIR_LEN;
+  if (!count) {
+    fprintf(stderr, "No pairs found in %s\n", options.input_filename);
+    goto failed;
+  }
+  if (!json && count > (u32)-1) {
+    fprintf(stderr, "Too many pairs to hold in memory (%llu), use --stream\n",
+            count);
+    goto failed;
+  }
+  const i32 use_matrix = options.nearest || options.count_within;
+  const i32 use_index  = options.radius_query || options.knn_query;
+  const i32 use_stats  = options.top_k || options.distribution;
+  arena = init_virtual_arena(process_arena_reserve(&options, count),
+                             options.arena_flags, &err);
+  if (err) {
+    fprintf(stderr, "Could not allocate arena (err %2d)\n", err);
+    goto failed;
+  }
+
+  HaversinePairs pairs = mapped.pairs;
+  if (packed.map) {
+    err = haversine_unpack_pairs(&packed, arena, &pairs);
+    haversine_unmap_packed(&packed);
+    if (err) {
+      fprintf(stderr, "Could not unpack %s (err %2d: %s)\n",
+              options.input_filename, err, haversine_err_to_cstr(err));
+      goto failed;
+    }
+  } else if (json) {
+    err = haversine_parse_pairs(json, json_len, arena, &pairs);
+    free(json);
+    json = 0;
+    if (err == INVALID_INPUT_HAVERSINE_ERR_TYPE) {
+      fprintf(stderr, "Too many pairs to hold in memory, use --stream\n");
+      goto failed;
+    }
+    if (!err && !pairs.count) {
+      fprintf(stderr, "No pairs found in %s\n", options.input_filename);
+      goto failed;
+    }
+    if (err) {
+      fprintf(stderr, "Could not parse %s (err %2d: %s)\n",
+              options.input_filename, err, haversine_err_to_cstr(err));
+      goto failed;
+    }
+    // a missing cache only costs the next run a parse
+    if (!options.no_cache &&
+        haversine_write_cache(options.input_filename, &pairs)) {
+      fprintf(stderr, "Could not write parse cache for %s\n",
+              options.input_filename);
+    }
+  }
+
+  // a parse cache stands in for its JSON source, report the source
+  printf("Input size : %llu\n",
+         mapped.source_size ? mapped.source_size : json_len);
+  printf("Pair count : %u\n", pairs.count);
+  if (options.pack_filename) {
+    u64 packed_size = 0;
+    err = haversine_write_packed(options.pack_filename, &pairs, &packed_size);
+    if (err) {
+      fprintf(stderr, "Could not pack into %s (err %2d: %s)\n",
+              options.pack_filename, err, haversine_err_to_cstr(err));
+      goto failed;
+    }
+    printf("Packed     : %llu bytes, %.2fx smaller than f64 columns\n",
+           packed_size, 4.0 * sizeof(f64) * pairs.count / packed_size);
+  }
+
+  f64                 avg     = 0;
+  HaversinePairs32    pairs32 = {0};
+  HaversineUnitPoints points0 = {0};
+  HaversineUnitPoints points1 = {0};
+  if (options.kernel == F32_PROCESS_KERNEL) {
+    err = haversine_pairs_to_f32(&pairs, &pairs32, arena);
+    if (err) {
+      fprintf(stderr, "Could not convert pairs to f32 (err %2d: %s)\n", err,
+              haversine_err_to_cstr(err));
+      goto failed;
+    }
+    HaversineF32Check check = {0};
+    avg = haversine_avg_f32_checked(&pairs, &pairs32, REF_EARTH_RADIUS_KM,
+                                    options.f32_tolerance_km, &check, &err);
+    printf("f32 avg    : %.16f\n", check.avg_f32);
+    printf("f64 avg    : %.16f\n", check.avg_f64);
+    printf("Avg dev    : %.16f (tolerance %f)\n", check.avg_deviation,
+           options.f32_tolerance_km);
+    printf("Max pair   : %.16f\n", check.max_pair_deviation);
+    if (err) {
+      fprintf(stderr, "Refusing f32 result (err %2d: %s)\n", err,
+              haversine_err_to_cstr(err));
+      goto failed;
+    }
+  } else if (options.kernel == UNIT_PROCESS_KERNEL) {
+    err = haversine_unit_points_from_pairs(&pairs, &points0, &points1, arena);
+    if (err) {
+      fprintf(stderr, "Could not convert pairs to unit vectors (err %2d: %s)\n",
+              err, haversine_err_to_cstr(err));
+      goto failed;
+    }
+    avg = haversine_sum_unit(&points0, &points1, REF_EARTH_RADIUS_KM) /
+          pairs.count;
+  } else {
+    avg = haversine_sum_f64(&pairs, REF_EARTH_RADIUS_KM) / pairs.count;
+  }
+  printf("Haversine  : %.16f\n", avg);
+
+  // every pass below only leaves scratch behind, rewound after it
+  const u64 scratch = checkpoint_arena(arena);
+  if (options.answers_f64_filename &&
+      !verify_kernel(&options, &pairs, &pairs32, &points0, &points1, arena)) {
+    goto failed;
+  }
+  rewind_arena(arena, scratch);
+
+  if (options.answer_filename) {
+    f64 answer = 0;
+    if (!read_answer(options.answer_filename, &answer)) {
+      fprintf(stderr, "Could not read answer from %s\n",
+              options.answer_filename);
+      goto failed;
+    }
+    printf("Reference  : %.16f\n", answer);
+    printf("Difference : %.16f\n", avg - answer);
+  }
+
+  if (use_matrix) {
+    if (!points0.count) {
+      err = haversine_unit_points_from_pairs(&pairs, &points0, &points1, arena);
+      if (err) {
+        fprintf(stderr, "Could not convert pairs to unit vectors (err %2d)\n",
+                err);
+      }
+    }
+    if (err || !run_matrix_queries(&options, &points0, &points1, arena)) {
+      goto failed;
+    }
+    rewind_arena(arena, scratch);
+  }
+
+  if (use_stats && !run_stats_pass(&options, &pairs, arena)) {
+    goto failed;
+  }
+  rewind_arena(arena, scratch);
+  if (use_index && !run_index_queries(&options, &pairs, arena)) {
+    goto failed;
+  }
+
+  haversine_unmap_pairs(&mapped);
+  print_arena_stats(arena, "main");
+  free_arena(arena);
+  return EXIT_SUCCESS;
+
+failed:
+  free(json);
+  haversine_unmap_packed(&packed);
+  haversine_unmap_pairs(&mapped);
+  free_arena(arena);
+  return EXIT_FAILURE;
+}
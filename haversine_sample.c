@@ -0,0 +1,116 @@
+#ifndef _BG_HAVERSINE_SAMPLE_C
+#define _BG_HAVERSINE_SAMPLE_C
+
+#include <math.h>
+#include <stdio.h>
+
+#include "haversine_formula.c"
+#include "haversine_pairs.c"
+#include "random.c"
+
+typedef unsigned int       u32;
+typedef unsigned long long u64;
+typedef int                i32;
+typedef double             f64;
+
+/*
+ * Approximate average from randomly placed reads.
+ *
+ * Every sample seeks to a random byte offset, reads a small window,
+ * resynchronises on the next '{' and parses that one pair. A running mean and
+ * variance (Welford) give a normal-approximation confidence interval; sampling
+ * stops once its half-width relative to the mean drops below the tolerance.
+ *
+ * A record is picked with probability proportional to the length of the
+ * record before it. The generated records only differ by a few digits in
+ * length, so this bias is far below any tolerance worth asking for.
+ */
+#define HAVERSINE_SAMPLE_WINDOW 256
+
+// 95% two-sided interval
+static const f64 HAVERSINE_SAMPLE_Z           = 1.959963984540054;
+// before this the variance estimate is too noisy to stop on
+static const u64 HAVERSINE_SAMPLE_MIN_SAMPLES = 100;
+
+typedef struct HaversineSampleResult {
+  f64 mean;
+  f64 half_width;
+  u64 samples;
+  u64 bytes_read;
+  u64 file_size;
+} HaversineSampleResult;
+
+/*
+ * Stops at rel_tolerance or after max_samples, whichever comes first. Fails
+ * with PARSE_HAVERSINE_ERR_TYPE if no window ever contained a whole pair.
+ */
+i32 haversine_sample_average(const char* filename, const f64 rel_tolerance,
+                             const u64 max_samples, const u64 seed,
+                             const f64              earth_radius,
+                             HaversineSampleResult* result) {
+  *result    = (HaversineSampleResult){0};
+  FILE* file = fopen(filename, "rb");
+  if (!file) {
+    return FILE_IO_HAVERSINE_ERR_TYPE;
+  }
+  fseeko(file, 0, SEEK_END);
+  result->file_size = (u64)ftello(file);
+  if (!result->file_size) {
+    fclose(file);
+    return PARSE_HAVERSINE_ERR_TYPE;
+  }
+
+  // every read is a single small pread-like request, no 4 KB stdio refills
+  setvbuf(file, 0, _IONBF, 0);
+
+  char         window[HAVERSINE_SAMPLE_WINDOW + 1];
+  RandomStream stream   = random_stream(seed);
+  u64          attempts = 0;
+  f64          mean     = 0;
+  f64          m2       = 0;
+  u64          n        = 0;
+  while (n < max_samples && attempts < 4 * max_samples) {
+    attempts++;
+    const u64 offset = random_next_u64(&stream) % result->file_size;
+    fseeko(file, (off_t)offset, SEEK_SET);
+    const size_t len = fread(window, 1, HAVERSINE_SAMPLE_WINDOW, file);
+    window[len]      = '\0';
+    result->bytes_read += len;
+
+    f64 x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+    // the window has to hold the whole object, a cut-off number parses short
+    char* end = haversine_parse_pair(window, &x0, &y0, &x1, &y1);
+    if (!end || !strchr(end, '}')) {
+      // text records turn up in nearly every window; none at all means the
+      // input is not text, and reading on would only take longer to say so
+      if (!n && attempts >= HAVERSINE_SAMPLE_MIN_SAMPLES) {
+        break;
+      }
+      continue;
+    }
+
+    const f64 distance = ReferenceHaversine(x0, y0, x1, y1, earth_radius);
+    n++;
+    const f64 delta = distance - mean;
+    mean += delta / n;
+    m2 += delta * (distance - mean);
+
+    if (n >= HAVERSINE_SAMPLE_MIN_SAMPLES) {
+      const f64 half_width = HAVERSINE_SAMPLE_Z * sqrt(m2 / (n - 1) / n);
+      if (half_width <= rel_tolerance * fabs(mean)) {
+        break;
+      }
+    }
+  }
+  fclose(file);
+
+  if (!n) {
+    return PARSE_HAVERSINE_ERR_TYPE;
+  }
+  result->mean       = mean;
+  result->half_width = n > 1 ? HAVERSINE_SAMPLE_Z * sqrt(m2 / (n - 1) / n) : 0;
+  result->samples    = n;
+  return NO_ERR_HAVERSINE_ERR_TYPE;
+}
+
+#endif  // _BG_HAVERSINE_SAMPLE_C
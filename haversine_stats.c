@@ -0,0 +1,220 @@
+#ifndef _BG_HAVERSINE_STATS_C
+#define _BG_HAVERSINE_STATS_C
+
+#include <math.h>
+
+#include "arena.c"
+#include "haversine_formula.c"
+#include "haversine_heap.c"
+#include "haversine_pairs.c"
+
+typedef unsigned int       u32;
+typedef unsigned long long u64;
+typedef int                i32;
+typedef double             f64;
+
+/*
+ * The k nearest or k farthest pairs seen, with their indices. Farthest keeps
+ * negated distances so both use the same bounded max-heap.
+ */
+typedef struct HaversineTopK {
+  f64* keys;
+  u32* ids;
+  u32  size;
+  u32  capacity;
+  i32  farthest;
+} HaversineTopK;
+
+i32 haversine_init_topk(HaversineTopK* topk, const u32 k, const i32 farthest,
+                        SimpleArena* arena) {
+  i32 arena_err = 0;
+  *topk         = (HaversineTopK){.capacity = k, .farthest = farthest};
+  topk->keys    = alloc_arena(arena, k * sizeof(f64), &arena_err);
+  topk->ids     = alloc_arena(arena, k * sizeof(u32), &arena_err);
+  return arena_err ? MEM_ALLOC_HAVERSINE_ERR_TYPE : NO_ERR_HAVERSINE_ERR_TYPE;
+}
+
+static inline void haversine_topk_push(HaversineTopK* topk, const f64 distance,
+                                       const u32 id) {
+  haversine_heap_push(topk->keys, topk->ids, &topk->size, topk->capacity,
+                      topk->farthest ? -distance : distance, id);
+}
+
+void haversine_topk_merge(HaversineTopK* dst, const HaversineTopK* src) {
+  for (u32 i = 0; i < src->size; i++) {
+    haversine_heap_push(dst->keys, dst->ids, &dst->size, dst->capacity,
+                        src->keys[i], src->ids[i]);
+  }
+}
+
+/*
+ * Sorts in place, best first. No more pushes after this.
+ */
+void haversine_topk_sort(HaversineTopK* topk) {
+  haversine_heap_sort(topk->keys, topk->ids, topk->size);
+}
+
+static inline f64 haversine_topk_distance(const HaversineTopK* topk,
+                                          const u32            idx) {
+  return topk->farthest ? -topk->keys[idx] : topk->keys[idx];
+}
+
+/*
+ * Mergeable quantile sketch with logarithmic buckets (as in DDSketch).
+ *
+ * Bucket i counts distances in (min * gamma^(i-1), min * gamma^i], with
+ * gamma = (1 + a) / (1 - a). Answering with the bucket's midpoint keeps the
+ * relative error of every quantile within a. With a = 1% and min = 1 m,
+ * 1024 buckets reach about 7.8 * 10^5 km, well past the 2 * 10^4 km of half
+ * the circumference, so every great-circle distance fits; shorter distances
+ * share the zero bucket. Merging is adding the counts.
+ */
+#define HAVERSINE_SKETCH_BUCKETS 1024
+
+static const f64 HAVERSINE_SKETCH_ACCURACY     = 0.01;
+static const f64 HAVERSINE_SKETCH_MIN_DISTANCE = 0.001;
+
+typedef struct HaversineQuantileSketch {
+  f64 gamma;
+  f64 inv_log_gamma;
+  u64 count;
+  u64 zero_count;
+  u64 counts[HAVERSINE_SKETCH_BUCKETS];
+} HaversineQuantileSketch;
+
+void haversine_init_sketch(HaversineQuantileSketch* sketch) {
+  *sketch = (HaversineQuantileSketch){0};
+  sketch->gamma =
+      (1.0 + HAVERSINE_SKETCH_ACCURACY) / (1.0 - HAVERSINE_SKETCH_ACCURACY);
+  sketch->inv_log_gamma = 1.0 / log(sketch->gamma);
+}
+
+static inline void haversine_sketch_add(HaversineQuantileSketch* sketch,
+                                        const f64                distance) {
+  sketch->count++;
+  if (distance <= HAVERSINE_SKETCH_MIN_DISTANCE) {
+    sketch->zero_count++;
+    return;
+  }
+  u32 bucket = (u32)ceil(log(distance / HAVERSINE_SKETCH_MIN_DISTANCE) *
+                         sketch->inv_log_gamma);
+  bucket     = bucket < HAVERSINE_SKETCH_BUCKETS ? bucket
+                                                 : HAVERSINE_SKETCH_BUCKETS - 1;
+  sketch->counts[bucket]++;
+}
+
+void haversine_merge_sketch(HaversineQuantileSketch*       dst,
+                            const HaversineQuantileSketch* src) {
+  dst->count += src->count;
+  dst->zero_count += src->zero_count;
+  for (u32 i = 0; i < HAVERSINE_SKETCH_BUCKETS; i++) {
+    dst->counts[i] += src->counts[i];
+  }
+}
+
+/*
+ * Distance at quantile q in [0, 1], within the sketch's relative accuracy.
+ */
+f64 haversine_sketch_quantile(const HaversineQuantileSketch* sketch,
+                              const f64                      q) {
+  if (!sketch->count) {
+    return 0;
+  }
+  const u64 rank = (u64)(q * (sketch->count - 1));
+  u64       seen = sketch->zero_count;
+  if (rank < seen) {
+    return 0;
+  }
+  for (u32 i = 0; i < HAVERSINE_SKETCH_BUCKETS; i++) {
+    seen += sketch->counts[i];
+    if (rank < seen) {
+      return HAVERSINE_SKETCH_MIN_DISTANCE * pow(sketch->gamma, i) * 2.0 /
+             (sketch->gamma + 1.0);
+    }
+  }
+  return 0;
+}
+
+/*
+ * Fixed-width distance histogram from 0 to half the circumference.
+ */
+#define HAVERSINE_HISTOGRAM_BUCKETS 64
+
+/*
+ * Everything a streaming pass accumulates. One per worker thread, merged into
+ * one at the end; nothing in here grows with the number of pairs.
+ */
+typedef struct HaversineStats {
+  f64                     sum;
+  u32                     count;
+  f64                     min;
+  f64                     max;
+  f64                     histogram_width;
+  u64                     histogram[HAVERSINE_HISTOGRAM_BUCKETS];
+  HaversineQuantileSketch sketch;
+  HaversineTopK           nearest;
+  HaversineTopK           farthest;
+} HaversineStats;
+
+i32 haversine_init_stats(HaversineStats* stats, const u32 top_k,
+                         const f64 earth_radius, SimpleArena* arena) {
+  *stats = (HaversineStats){
+      .min             = INFINITY,
+      .max             = -INFINITY,
+      .histogram_width = 3.14159265358979323846 * earth_radius /
+                         HAVERSINE_HISTOGRAM_BUCKETS,
+  };
+  haversine_init_sketch(&stats->sketch);
+  i32 err = haversine_init_topk(&stats->nearest, top_k, 0, arena);
+  if (!err) {
+    err = haversine_init_topk(&stats->farthest, top_k, 1, arena);
+  }
+  return err;
+}
+
+static inline void haversine_stats_add(HaversineStats* stats,
+                                       const f64 distance, const u32 id) {
+  stats->sum += distance;
+  stats->count++;
+  stats->min = distance < stats->min ? distance : stats->min;
+  stats->max = distance > stats->max ? distance : stats->max;
+
+  u32 bucket = (u32)(distance / stats->histogram_width);
+  bucket     = bucket < HAVERSINE_HISTOGRAM_BUCKETS
+                   ? bucket
+                   : HAVERSINE_HISTOGRAM_BUCKETS - 1;
+  stats->histogram[bucket]++;
+  haversine_sketch_add(&stats->sketch, distance);
+
+  haversine_topk_push(&stats->nearest, distance, id);
+  haversine_topk_push(&stats->farthest, distance, id);
+}
+
+void haversine_merge_stats(HaversineStats* dst, const HaversineStats* src) {
+  dst->sum += src->sum;
+  dst->count += src->count;
+  dst->min = src->min < dst->min ? src->min : dst->min;
+  dst->max = src->max > dst->max ? src->max : dst->max;
+  for (u32 i = 0; i < HAVERSINE_HISTOGRAM_BUCKETS; i++) {
+    dst->histogram[i] += src->histogram[i];
+  }
+  haversine_merge_sketch(&dst->sketch, &src->sketch);
+  haversine_topk_merge(&dst->nearest, &src->nearest);
+  haversine_topk_merge(&dst->farthest, &src->farthest);
+}
+
+/*
+ * Reference distances of pairs [begin, end) into stats.
+ */
+void haversine_accumulate_stats(const HaversinePairs* pairs, const u32 begin,
+                                const u32 end, const f64 earth_radius,
+                                HaversineStats* stats) {
+  for (u32 i = begin; i < end; i++) {
+    const f64 distance = ReferenceHaversine(pairs->x0[i], pairs->y0[i],
+                                            pairs->x1[i], pairs->y1[i],
+                                            earth_radius);
+    haversine_stats_add(stats, distance, i);
+  }
+}
+
+#endif  // _BG_HAVERSINE_STATS_C
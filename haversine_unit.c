@@ -0,0 +1,112 @@
+#ifndef _BG_HAVERSINE_UNIT_C
+#define _BG_HAVERSINE_UNIT_C
+
+#include <math.h>
+
+#include "arena.c"
+#include "haversine_pairs.c"
+
+typedef unsigned int u32;
+typedef int          i32;
+typedef double       f64;
+
+/*
+ * Points as 3D unit vectors (cos lat cos lon, cos lat sin lon, sin lat), one
+ * column per component. Converting costs the trig calls once per point; every
+ * distance afterwards is a chord length and a single asin().
+ */
+typedef struct HaversineUnitPoints {
+  f64* x;
+  f64* y;
+  f64* z;
+  u32  count;
+} HaversineUnitPoints;
+
+i32 haversine_alloc_unit_points(HaversineUnitPoints* points, const u32 count,
+                                SimpleArena* arena) {
+  const u64 size      = count * sizeof(f64);
+  const u64 align     = ARENA_CACHE_LINE;
+  i32       arena_err = 0;
+  points->x           = alloc_arena_aligned(arena, size, align, &arena_err);
+  points->y           = alloc_arena_aligned(arena, size, align, &arena_err);
+  points->z           = alloc_arena_aligned(arena, size, align, &arena_err);
+  points->count       = count;
+  return arena_err ? MEM_ALLOC_HAVERSINE_ERR_TYPE : NO_ERR_HAVERSINE_ERR_TYPE;
+}
+
+void haversine_set_unit_point(HaversineUnitPoints* points, const u32 idx,
+                              const f64 lon_deg, const f64 lat_deg) {
+  const f64 rad_per_deg = 0.01745329251994329577;
+  const f64 lon         = rad_per_deg * lon_deg;
+  const f64 lat         = rad_per_deg * lat_deg;
+  const f64 cos_lat     = cos(lat);
+  points->x[idx]        = cos_lat * cos(lon);
+  points->y[idx]        = cos_lat * sin(lon);
+  points->z[idx]        = sin(lat);
+}
+
+/*
+ * Great-circle distance from the chord: the central angle is 2 asin(c / 2).
+ * The chord is taken from the component differences rather than 1 - dot,
+ * which would cancel catastrophically for nearby points.
+ */
+static inline f64 haversine_unit_distance(const f64 ax, const f64 ay,
+                                          const f64 az, const f64 bx,
+                                          const f64 by, const f64 bz,
+                                          const f64 earth_radius) {
+  const f64 dx         = ax - bx;
+  const f64 dy         = ay - by;
+  const f64 dz         = az - bz;
+  f64       half_chord = 0.5 * sqrt(dx * dx + dy * dy + dz * dz);
+  half_chord           = half_chord > 1.0 ? 1.0 : half_chord;
+  return earth_radius * 2.0 * asin(half_chord);
+}
+
+/*
+ * Splits the pairs into their start and end points.
+ */
+i32 haversine_unit_points_from_pairs(const HaversinePairs* pairs,
+                                     HaversineUnitPoints*  points0,
+                                     HaversineUnitPoints*  points1,
+                                     SimpleArena*          arena) {
+  i32 err = haversine_alloc_unit_points(points0, pairs->count, arena);
+  if (!err) {
+    err = haversine_alloc_unit_points(points1, pairs->count, arena);
+  }
+  if (err) {
+    return err;
+  }
+  for (u32 i = 0; i < pairs->count; i++) {
+    haversine_set_unit_point(points0, i, pairs->x0[i], pairs->y0[i]);
+    haversine_set_unit_point(points1, i, pairs->x1[i], pairs->y1[i]);
+  }
+  return NO_ERR_HAVERSINE_ERR_TYPE;
+}
+
+/*
+ * Element-wise distances between points0[i] and points1[i].
+ */
+f64 haversine_sum_unit(const HaversineUnitPoints* points0,
+                       const HaversineUnitPoints* points1,
+                       const f64                  earth_radius) {
+  f64 sum = 0;
+  for (u32 i = 0; i < points0->count; i++) {
+    sum += haversine_unit_distance(points0->x[i], points0->y[i], points0->z[i],
+                                   points1->x[i], points1->y[i], points1->z[i],
+                                   earth_radius);
+  }
+  return sum;
+}
+
+void haversine_distances_unit(const HaversineUnitPoints* points0,
+                              const HaversineUnitPoints* points1,
+                              const f64 earth_radius, f64* out) {
+  for (u32 i = 0; i < points0->count; i++) {
+    out[i] = haversine_unit_distance(points0->x[i], points0->y[i],
+                                     points0->z[i], points1->x[i],
+                                     points1->y[i], points1->z[i],
+                                     earth_radius);
+  }
+}
+
+#endif  // _BG_HAVERSINE_UNIT_C
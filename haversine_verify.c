@@ -0,0 +1,161 @@
+#ifndef _BG_HAVERSINE_VERIFY_C
+#define _BG_HAVERSINE_VERIFY_C
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "haversine_pairs.c"
+
+typedef unsigned int       u32;
+typedef unsigned long long u64;
+typedef long long          i64;
+typedef int                i32;
+typedef double             f64;
+
+/*
+ * Binary answers file written by haversine_gen:
+ * count raw f64 distances, then the f64 sum, then the f64 average.
+ */
+typedef struct HaversineAnswers {
+  f64* distances;
+  u32  count;
+  f64  sum;
+  f64  avg;
+} HaversineAnswers;
+
+/*
+ * distances points into a malloc'd buffer, release with
+ * haversine_free_answers().
+ */
+i32 haversine_read_answers(const char* filename, HaversineAnswers* answers) {
+  i32   err      = 0;
+  u64   file_len = 0;
+  char* buf      = haversine_read_file(filename, &file_len, &err);
+  if (err) {
+    return err;
+  }
+  const u64 num_f64 = file_len / sizeof(f64);
+  if (file_len % sizeof(f64) || num_f64 < 2 || num_f64 - 2 > (u32)-1) {
+    free(buf);
+    return PARSE_HAVERSINE_ERR_TYPE;
+  }
+  f64* values = (f64*)buf;
+  *answers    = (HaversineAnswers){
+      .distances = values,
+      .count     = (u32)(num_f64 - 2),
+      .sum       = values[num_f64 - 2],
+      .avg       = values[num_f64 - 1],
+  };
+  return NO_ERR_HAVERSINE_ERR_TYPE;
+}
+
+void haversine_free_answers(HaversineAnswers* answers) {
+  free(answers->distances);
+  *answers = (HaversineAnswers){0};
+}
+
+/*
+ * Bucket 0 counts exact matches, bucket k counts errors of [2^(k-1), 2^k) ULPs.
+ */
+#define HAVERSINE_ULP_BUCKET_COUNT 65
+
+typedef struct HaversineVerifyReport {
+  u32 count;
+  u32 max_abs_error_idx;
+  f64 max_abs_error;
+  f64 mean_abs_error;
+  u64 max_ulp_error;
+  f64 candidate_sum;
+  f64 candidate_avg;
+  u64 ulp_histogram[HAVERSINE_ULP_BUCKET_COUNT];
+} HaversineVerifyReport;
+
+/*
+ * Maps the bit pattern onto integers that are ordered like the floats, so the
+ * difference of two mapped values is their distance in ULPs.
+ */
+static i64 haversine_ordered_bits(const f64 val) {
+  i64 bits = 0;
+  memcpy(&bits, &val, sizeof(bits));
+  return bits < 0 ? (i64)((u64)1 << 63) - bits : bits;
+}
+
+u64 haversine_ulp_distance(const f64 lhs, const f64 rhs) {
+  const i64 lhs_bits = haversine_ordered_bits(lhs);
+  const i64 rhs_bits = haversine_ordered_bits(rhs);
+  return lhs_bits > rhs_bits ? (u64)lhs_bits - (u64)rhs_bits
+                             : (u64)rhs_bits - (u64)lhs_bits;
+}
+
+static u32 haversine_ulp_bucket(u64 ulp) {
+  u32 bucket = 0;
+  while (ulp) {
+    bucket++;
+    ulp >>= 1;
+  }
+  return bucket;
+}
+
+/*
+ * Compares `candidate` (answers->count per-pair distances) against the
+ * reference answers.
+ */
+i32 haversine_verify_distances(const f64* candidate,
+                               const HaversineAnswers* answers,
+                               HaversineVerifyReport*  report) {
+  if (!candidate || !answers || !report) {
+    return NULL_POINTER_HAVERSINE_ERR_TYPE;
+  }
+  *report = (HaversineVerifyReport){.count = answers->count};
+
+  f64 sum_abs_error = 0;
+  for (u32 i = 0; i < answers->count; i++) {
+    const f64 abs_error = fabs(candidate[i] - answers->distances[i]);
+    const u64 ulp_error = haversine_ulp_distance(candidate[i],
+                                                 answers->distances[i]);
+    if (abs_error > report->max_abs_error) {
+      report->max_abs_error     = abs_error;
+      report->max_abs_error_idx = i;
+    }
+    if (ulp_error > report->max_ulp_error) {
+      report->max_ulp_error = ulp_error;
+    }
+    report->ulp_histogram[haversine_ulp_bucket(ulp_error)]++;
+    sum_abs_error += abs_error;
+    report->candidate_sum += candidate[i];
+  }
+  if (answers->count) {
+    report->mean_abs_error = sum_abs_error / answers->count;
+    report->candidate_avg  = report->candidate_sum / answers->count;
+  }
+  return NO_ERR_HAVERSINE_ERR_TYPE;
+}
+
+void haversine_print_verify_report(const HaversineVerifyReport* report,
+                                   const HaversineAnswers*      answers) {
+  printf("Verified   : %u pairs\n", report->count);
+  printf("Max error  : %.16f (pair %u)\n", report->max_abs_error,
+         report->max_abs_error_idx);
+  printf("Mean error : %.16f\n", report->mean_abs_error);
+  printf("Max ULP    : %llu\n", report->max_ulp_error);
+  printf("Sum        : %.16f (reference %.16f)\n", report->candidate_sum,
+         answers->sum);
+  printf("Avg        : %.16f (reference %.16f)\n", report->candidate_avg,
+         answers->avg);
+  printf("ULP error histogram:\n");
+  for (u32 bucket = 0; bucket < HAVERSINE_ULP_BUCKET_COUNT; bucket++) {
+    if (!report->ulp_histogram[bucket]) {
+      continue;
+    }
+    if (bucket == 0) {
+      printf("  %-13s : %llu\n", "0", report->ulp_histogram[bucket]);
+    } else {
+      printf("  [2^%2u, 2^%2u) : %llu\n", bucket - 1, bucket,
+             report->ulp_histogram[bucket]);
+    }
+  }
+}
+
+#endif  // _BG_HAVERSINE_VERIFY_C
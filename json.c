@@ -3,9 +3,10 @@
 #include "arena.c"
 #include "string.c"
 
-typedef unsigned int u32;
-typedef int          i32;
-typedef double       f64;
+typedef unsigned int       u32;
+typedef unsigned long long u64;
+typedef int                i32;
+typedef double             f64;
 
 enum JsonValType {
   UNKNOWN_JSON_VAL_TYPE = 0,
@@ -14,14 +15,28 @@ enum JsonValType {
   FLOAT_JSON_VAL_TYPE,
 };
 
+/*
+ * References are RelPtr, so a tree built in one arena survives
+ * save_arena() / load_arena(). children points to num_children RelPtr, one
+ * per child. Build objects in place, a copy no longer points anywhere.
+ */
 typedef struct JsonObj {
-  String*          key;
-  void*            val;
+  RelPtr           key;
+  RelPtr           val;
   enum JsonValType type_val;
   u32              num_children;
-  struct JsonObj** children;
+  RelPtr           children;
 } JsonObj;
 
+static inline String* json_key(const JsonObj* json_obj) {
+  return rel_ptr_get(&json_obj->key);
+}
+
+static inline JsonObj* json_child(const JsonObj* json_obj, const u32 idx) {
+  const RelPtr* children = rel_ptr_get(&json_obj->children);
+  return rel_ptr_get(&children[idx]);
+}
+
 /*
  * errors
  */
@@ -30,6 +45,7 @@ enum JsonErrorType {
   NULL_POINTER_JSON_ERR_TYPE,
   INVALID_VAL_TYPE_JSON_ERR_TYPE,
   NON_EXISTING_INDEX_JSON_ERR_TYPE,
+  MEM_ALLOC_JSON_ERR_TYPE,
 };
 
 const char* json_err_to_cstr(const enum JsonErrorType json_err) {
@@ -42,6 +58,8 @@ const char* json_err_to_cstr(const enum JsonErrorType json_err) {
       return "invalid value type";
     case NON_EXISTING_INDEX_JSON_ERR_TYPE:
       return "non-existing index";
+    case MEM_ALLOC_JSON_ERR_TYPE:
+      return "memory allocation failed";
     default:
       return "unknown error code";
   }
@@ -61,8 +79,8 @@ JsonObj* json_get_key(JsonObj* json_obj, String* key, i32* json_err) {
   }
   JsonObj* child = 0;
   for (u32 i = 0; i < json_obj->num_children; i++) {
-    if (0 == string_compare(key, json_obj->children[i]->key)) {
-      child = json_obj->children[i];
+    if (0 == string_compare(key, json_key(json_child(json_obj, i)))) {
+      child = json_child(json_obj, i);
       break;
     }
   }
@@ -83,7 +101,7 @@ JsonObj* json_get_idx(JsonObj* json_obj, const u32 idx, i32* json_err) {
     return 0;
   }
   *json_err = NO_ERR_JSON_ERR_TYPE;
-  return json_obj->children[idx];
+  return json_child(json_obj, idx);
 }
 
 /*
@@ -99,7 +117,105 @@ f64 json_to_float(JsonObj* json_obj, i32* json_err) {
     return 0;
   }
   *json_err = NO_ERR_JSON_ERR_TYPE;
-  return *(f64*)(json_obj->val);
+  return *(f64*)rel_ptr_get(&json_obj->val);
+}
+
+/*
+ * build
+ *
+ * Nodes, child arrays and float values come from an ArenaPool, so a subtree
+ * can be dropped with json_free() and its memory reused by the next one
+ * instead of growing the arena. Keys are only referenced, never freed.
+ *
+ * Child arrays past ARENA_POOL_MAX_SIZE (8192 children) are taken from the
+ * pool's arena directly. num_children tells which kind a node has, and
+ * json_free() leaves arena-backed arrays to the arena.
+ */
+static inline u64 json_children_size(const u32 num_children) {
+  return (u64)num_children * sizeof(RelPtr);
+}
+
+static inline i32 json_children_pooled(const u32 num_children) {
+  return json_children_size(num_children) <= ARENA_POOL_MAX_SIZE;
+}
+
+JsonObj* json_new_float(ArenaPool* pool, String* key, const f64 val,
+                        i32* json_err) {
+  i32      pool_err = 0;
+  JsonObj* json_obj = alloc_pool(pool, sizeof(JsonObj), &pool_err);
+  f64*     value    = alloc_pool(pool, sizeof(f64), &pool_err);
+  if (pool_err) {
+    free_pool_slot(pool, json_obj, sizeof(JsonObj));
+    free_pool_slot(pool, value, sizeof(f64));
+    *json_err = MEM_ALLOC_JSON_ERR_TYPE;
+    return 0;
+  }
+  *value    = val;
+  *json_obj = (JsonObj){.type_val = FLOAT_JSON_VAL_TYPE};
+  rel_ptr_set(&json_obj->key, key);
+  rel_ptr_set(&json_obj->val, value);
+  return json_obj;
+}
+
+/*
+ * type_val is OBJ_JSON_VAL_TYPE or ARRAY_JSON_VAL_TYPE. All children start
+ * out empty, fill them with json_set_child().
+ */
+JsonObj* json_new_container(ArenaPool* pool, String* key,
+                            const enum JsonValType type_val,
+                            const u32 num_children, i32* json_err) {
+  i32      pool_err = 0;
+  JsonObj* json_obj = alloc_pool(pool, sizeof(JsonObj), &pool_err);
+  RelPtr*  children = 0;
+  const u64 children_size = json_children_size(num_children);
+  if (num_children && json_children_pooled(num_children)) {
+    children = alloc_pool(pool, children_size, &pool_err);
+  } else if (num_children && json_obj) {
+    children = alloc_arena(pool->arena, children_size, &pool_err);
+  }
+  if (pool_err) {
+    free_pool_slot(pool, json_obj, sizeof(JsonObj));
+    if (json_children_pooled(num_children)) {
+      free_pool_slot(pool, children, children_size);
+    }
+    *json_err = MEM_ALLOC_JSON_ERR_TYPE;
+    return 0;
+  }
+  *json_obj = (JsonObj){.type_val = type_val, .num_children = num_children};
+  rel_ptr_set(&json_obj->key, key);
+  rel_ptr_set(&json_obj->children, children);
+  for (u32 i = 0; i < num_children; i++) {
+    children[i] = 0;
+  }
+  return json_obj;
+}
+
+static inline void json_set_child(JsonObj* json_obj, const u32 idx,
+                                  JsonObj* child) {
+  RelPtr* children = rel_ptr_get(&json_obj->children);
+  rel_ptr_set(&children[idx], child);
+}
+
+/*
+ * Frees json_obj and everything below it, for trees built with json_new_*.
+ */
+void json_free(ArenaPool* pool, JsonObj* json_obj) {
+  if (!json_obj) {
+    return;
+  }
+  if (json_obj->type_val == FLOAT_JSON_VAL_TYPE) {
+    free_pool_slot(pool, rel_ptr_get(&json_obj->val), sizeof(f64));
+  }
+  if (json_obj->num_children) {
+    for (u32 i = 0; i < json_obj->num_children; i++) {
+      json_free(pool, json_child(json_obj, i));
+    }
+    if (json_children_pooled(json_obj->num_children)) {
+      free_pool_slot(pool, rel_ptr_get(&json_obj->children),
+                     json_children_size(json_obj->num_children));
+    }
+  }
+  free_pool_slot(pool, json_obj, sizeof(JsonObj));
 }
 
 /*
@@ -127,49 +243,63 @@ JsonObj* cstr_to_json(char* json_c_str, SimpleArena* arena, i32* json_err) {
    */
 
 int initial_demo() {
-  f64      my_float_val_1     = 1.1f;
-  f64      my_float_val_2     = 2.2f;
-  JsonObj  valid_json_obj_1   = {.val      = (void*)(&my_float_val_1),
-                                 .type_val = FLOAT_JSON_VAL_TYPE};
-  JsonObj  invalid_json_obj_1 = {.val      = (void*)(&my_float_val_2),
-                                 .type_val = UNKNOWN_JSON_VAL_TYPE};
+  // RelPtrs only reach within one allocation, so the tree lives in an arena
+  i32          err        = 0;
+  SimpleArena* arena      = init_arena(4096, 0, &err);
+  f64*         float_vals = alloc_arena(arena, 2 * sizeof(f64), &err);
+  JsonObj*     objs       = alloc_arena(arena, 3 * sizeof(JsonObj), &err);
+  RelPtr*      children   = alloc_arena(arena, 2 * sizeof(RelPtr), &err);
+  if (err) {
+    printf("Could not allocate the demo tree (err %2d)\n", err);
+    free_arena(arena);
+    return 1;
+  }
+  JsonObj* valid_json_obj_1   = &objs[0];
+  JsonObj* invalid_json_obj_1 = &objs[1];
+  JsonObj* full_json          = &objs[2];
   JsonObj  null_json_obj      = {0};
-  JsonObj* children[2]        = {&valid_json_obj_1, &invalid_json_obj_1};
-  JsonObj  full_json          = {.children = children, .num_children = 2};
   f64      result             = 0.0f;
 
-  enum JsonErrorType err = NO_ERR_JSON_ERR_TYPE;
+  float_vals[0]       = 1.1f;
+  float_vals[1]       = 2.2f;
+  *valid_json_obj_1   = (JsonObj){.type_val = FLOAT_JSON_VAL_TYPE};
+  *invalid_json_obj_1 = (JsonObj){.type_val = UNKNOWN_JSON_VAL_TYPE};
+  *full_json          = (JsonObj){.num_children = 2};
+  rel_ptr_set(&valid_json_obj_1->val, &float_vals[0]);
+  rel_ptr_set(&invalid_json_obj_1->val, &float_vals[1]);
+  rel_ptr_set(&children[0], valid_json_obj_1);
+  rel_ptr_set(&children[1], invalid_json_obj_1);
+  rel_ptr_set(&full_json->children, children);
 
-  JsonObj* invalid_json_obj_2 = json_get_idx(&full_json, 0, &err);
-  full_json.type_val          = ARRAY_JSON_VAL_TYPE;
-  JsonObj* valid_json_obj_2   = json_get_idx(&full_json, 0, &err);
+  JsonObj* invalid_json_obj_2 = json_get_idx(full_json, 0, &err);
+  full_json->type_val         = ARRAY_JSON_VAL_TYPE;
+  JsonObj* valid_json_obj_2   = json_get_idx(full_json, 0, &err);
 
   result = json_to_float(&null_json_obj, &err);
   printf("Null JSON as float       : %.3f (err %2d: %s)\n", result, err,
          json_err_to_cstr(err));
-  result = json_to_float(&invalid_json_obj_1, &err);
+  result = json_to_float(invalid_json_obj_1, &err);
   printf("Invalid JSON (1) as float: %.3f (err %2d: %s)\n", result, err,
          json_err_to_cstr(err));
   result = json_to_float(invalid_json_obj_2, &err);
   printf("Invalid JSON (2) as float: %.3f (err %2d: %s)\n", result, err,
          json_err_to_cstr(err));
-  result = json_to_float(&valid_json_obj_1, &err);
+  result = json_to_float(valid_json_obj_1, &err);
   printf("Valid JSON (1) as float  : %.3f (err %2d: %s)\n", result, err,
          json_err_to_cstr(err));
   result = json_to_float(valid_json_obj_2, &err);
   printf("Valid JSON (2) as float  : %.3f (err %2d: %s)\n", result, err,
          json_err_to_cstr(err));
 
-  err                  = 0;
-  SimpleArena* arena   = init_arena(4096, &err);
-  String*      key_1   = string_from_c_str("k1", arena, &err);
-  String*      key_2   = string_from_c_str("k2", arena, &err);
-  valid_json_obj_1.key = key_1;
-  full_json.type_val   = OBJ_JSON_VAL_TYPE;
+  err           = 0;
+  String* key_1 = string_from_c_str("k1", arena, &err);
+  String* key_2 = string_from_c_str("k2", arena, &err);
+  rel_ptr_set(&valid_json_obj_1->key, key_1);
+  full_json->type_val = OBJ_JSON_VAL_TYPE;
 
   printf("Added keys %s and %s\n", key_1->c_str, key_2->c_str);
 
-  JsonObj* json_obj_via_key_1 = json_get_key(&full_json, key_1, &err);
+  JsonObj* json_obj_via_key_1 = json_get_key(full_json, key_1, &err);
   if (err) {
     printf("JSON key access error (err %2d: %s)\n", err, json_err_to_cstr(err));
     err = 0;
@@ -177,7 +307,7 @@ int initial_demo() {
   result = json_to_float(json_obj_via_key_1, &err);
   printf("JSON via key (%s) as float  : %.3f (err %2d: %s)\n", key_1->c_str,
          result, err, json_err_to_cstr(err));
-  JsonObj* json_obj_via_key_2 = json_get_key(&full_json, key_2, &err);
+  JsonObj* json_obj_via_key_2 = json_get_key(full_json, key_2, &err);
   if (err) {
     printf("JSON key access error (err %2d: %s)\n", err, json_err_to_cstr(err));
     err = 0;
@@ -212,6 +342,7 @@ int stack_demo() {
   SimpleStack* stack = init_stack(4096, &err);
   if (err) {
     printf("Error during init_stack (err: %d)\n", err);
+    return 1;
   }
 
   enum StackDataType data_type = I32_STACK_DATA_TYPE;
@@ -231,7 +362,119 @@ int stack_demo() {
   demo_pop_stack("3");
   demo_pop_stack("4");
 
+  free_stack(stack);
   return 0;
 }
 
-int main() { return stack_demo(); }
+/*
+ * Builds {"k1": 1.5, "k2": 2.5} in an arena, writes a snapshot and reads
+ * "k2" back from the mapped copy.
+ */
+int snapshot_demo() {
+  const char*  path      = "json_snapshot.bin";
+  const char*  keys[2]   = {"k1", "k2"};
+  const f64    values[2] = {1.5, 2.5};
+  i32          err       = 0;
+  int          result    = 1;
+  SimpleArena* loaded    = 0;
+  SimpleArena* arena     = init_arena(4096, 0, &err);
+  JsonObj*     root      = alloc_arena(arena, sizeof(JsonObj), &err);
+  RelPtr*      children  = alloc_arena(arena, 2 * sizeof(RelPtr), &err);
+  if (err) {
+    printf("Error during arena allocation (err: %d)\n", err);
+    goto cleanup;
+  }
+  *root = (JsonObj){.type_val = OBJ_JSON_VAL_TYPE, .num_children = 2};
+  rel_ptr_set(&root->children, children);
+  for (u32 i = 0; i < 2; i++) {
+    JsonObj* child = alloc_arena(arena, sizeof(JsonObj), &err);
+    f64*     val   = alloc_arena(arena, sizeof(f64), &err);
+    String*  key   = string_from_c_str((char*)keys[i], arena, &err);
+    if (err) {
+      printf("Error during arena allocation (err: %d)\n", err);
+      goto cleanup;
+    }
+    *val   = values[i];
+    *child = (JsonObj){.type_val = FLOAT_JSON_VAL_TYPE};
+    rel_ptr_set(&child->key, key);
+    rel_ptr_set(&child->val, val);
+    rel_ptr_set(&children[i], child);
+  }
+  String* lookup = string_from_c_str("k2", arena, &err);
+  if (err) {
+    printf("Error during arena allocation (err: %d)\n", err);
+    goto cleanup;
+  }
+
+  err = save_arena(arena, arena_offset(arena, root), path);
+  printf("Saved %llu arena bytes to %s (err %2d)\n", arena->idx, path, err);
+  if (err) {
+    goto cleanup;
+  }
+
+  u64 entry = 0;
+  loaded    = load_arena(path, &entry, &err);
+  if (err) {
+    printf("Error during load_arena (err: %d)\n", err);
+    goto cleanup;
+  }
+  JsonObj* loaded_root = arena_at(loaded, entry);
+  f64 value = json_to_float(json_get_key(loaded_root, lookup, &err), &err);
+  printf("Snapshot JSON via key (%s) as float: %.3f (err %2d: %s)\n",
+         lookup->c_str, value, err, json_err_to_cstr(err));
+  result = 0;
+
+cleanup:
+  free_loaded_arena(loaded);
+  free_arena(arena);
+  remove(path);
+  return result;
+}
+
+/*
+ * Rebuilds an object with 100 float members over and over, freeing the
+ * previous one each round. The arena stops growing after the first round.
+ */
+int pool_demo() {
+  const u32    num_children = 100;
+  const u32    rounds       = 1000;
+  i32          err          = 0;
+  SimpleArena* arena        = init_arena(1 << 20, 0, &err);
+  String*      key          = string_from_c_str("k", arena, &err);
+  if (err) {
+    printf("Error during arena allocation (err: %d)\n", err);
+    return 1;
+  }
+  ArenaPool pool       = init_pool(arena);
+  JsonObj*  root       = 0;
+  u64       first_used = 0;
+  for (u32 round = 0; round < rounds && !err; round++) {
+    json_free(&pool, root);
+    root = json_new_container(&pool, 0, ARRAY_JSON_VAL_TYPE, num_children,
+                              &err);
+    for (u32 i = 0; i < num_children && !err; i++) {
+      json_set_child(root, i, json_new_float(&pool, key, round + i, &err));
+    }
+    if (!round) {
+      first_used = arena->idx;
+    }
+  }
+  f64 result = json_to_float(json_get_idx(root, 2, &err), &err);
+  printf("Rebuilt %u times, arena use %llu -> %llu bytes\n", rounds,
+         first_used, arena->idx);
+  printf("Last JSON at idx 2 as float: %.3f (err %2d: %s)\n", result, err,
+         json_err_to_cstr(err));
+
+  free_arena(arena);
+  return 0;
+}
+
+int main() {
+  // each demo reports its own errors, so a failing one does not stop the rest
+  int failed = 0;
+  failed |= initial_demo();
+  failed |= stack_demo();
+  failed |= snapshot_demo();
+  failed |= pool_demo();
+  return failed;
+}
@@ -6,20 +6,47 @@
 #define BUILD_FOLDER "build/"
 #define SRC_FOLDER ""
 
+// `./nob arena-stats` builds with arena instrumentation, see arena.c
+static bool arena_stats = false;
+
+static bool build_program(Nob_Cmd *cmd, const char *name) {
+  nob_cmd_append(cmd, "clang");
+  nob_cmd_append(cmd, "-Wall", "-Wextra", "-O2");
+  // nothing reads errno or FP exception flags; without these the f32 kernel's
+  // sqrtf calls and float selects keep its loop scalar
+  nob_cmd_append(cmd, "-fno-math-errno", "-fno-trapping-math");
+  if (arena_stats)
+    nob_cmd_append(cmd, "-DARENA_STATS");
+  nob_cmd_append(cmd, "-o", nob_temp_sprintf(BUILD_FOLDER "%s.exe", name));
+  nob_cmd_append(cmd, nob_temp_sprintf(SRC_FOLDER "%s.c", name));
+  nob_cmd_append(cmd, "-lm", "-pthread");
+
+  return nob_cmd_run_sync_and_reset(cmd);
+}
+
 int main(int argc, char **argv) {
   NOB_GO_REBUILD_URSELF(argc, argv);
 
+#ifdef _WIN32
+  // the arenas, input mappings and worker threads use mmap, mprotect and
+  // pthreads; there are no VirtualAlloc or Win32 thread fallbacks
+  nob_log(NOB_ERROR, "Windows is not supported, the programs need POSIX");
+  return 1;
+#endif
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "arena-stats") == 0)
+      arena_stats = true;
+  }
+
   if (!nob_mkdir_if_not_exists(BUILD_FOLDER))
     return 1;
 
   Nob_Cmd cmd = {0};
 
-  nob_cmd_append(&cmd, "clang");
-  nob_cmd_append(&cmd, "-Wall", "-Wextra");
-  nob_cmd_append(&cmd, "-o", BUILD_FOLDER "haversine_gen.exe");
-  nob_cmd_append(&cmd, SRC_FOLDER "haversine_gen.c");
-
-  if (!nob_cmd_run_sync_and_reset(&cmd))
+  if (!build_program(&cmd, "haversine_gen"))
+    return 1;
+  if (!build_program(&cmd, "haversine_process"))
     return 1;
 
   return 0;
@@ -0,0 +1,45 @@
+#ifndef _BG_RANDOM_C
+#define _BG_RANDOM_C
+
+typedef unsigned long long u64;
+typedef double             f64;
+
+/*
+ * Counter-based random stream: the n-th output is splitmix64's finaliser
+ * applied to seed + n * golden ratio. No hidden global state, full 64-bit
+ * outputs, and seeking to any position is a single assignment, so a range of
+ * records can be generated anywhere without producing the ones before it.
+ */
+typedef struct RandomStream {
+  u64 seed;
+  u64 counter;
+} RandomStream;
+
+static const u64 RANDOM_GOLDEN_GAMMA = 0x9E3779B97F4A7C15ull;
+
+static inline RandomStream random_stream(const u64 seed) {
+  return (RandomStream){.seed = seed, .counter = 0};
+}
+
+static inline void random_seek(RandomStream* stream, const u64 position) {
+  stream->counter = position;
+}
+
+static inline u64 random_mix(u64 z) {
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+static inline u64 random_next_u64(RandomStream* stream) {
+  return random_mix(stream->seed + ++stream->counter * RANDOM_GOLDEN_GAMMA);
+}
+
+/*
+ * Uniform in [0, 1) from the top 53 bits.
+ */
+static inline f64 random_next_f64(RandomStream* stream) {
+  return (f64)(random_next_u64(stream) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+#endif  // _BG_RANDOM_C
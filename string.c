@@ -5,16 +5,19 @@
 
 #include "arena.c"
 
-typedef unsigned int u32;
-typedef int          i32;
+typedef unsigned int       u32;
+typedef unsigned long long u64;
+typedef int                i32;
 
 /*
  * allocates len+1 bytes for the buffer
  * last character of buf is '\0'
+ * the characters follow the struct, so a String holds no pointer and can be
+ * part of an arena snapshot
  */
 typedef struct String {
-  char* c_str;
-  u32   len;
+  u64  len;
+  char c_str[];
 } String;
 
 enum StringErrorType {
@@ -28,20 +31,18 @@ const u32 MAX_LEN_C_STR = 1 << 15;
 
 /*
  * Return 0 if lhs or rhs is NULL.
- * Return (lhs->len - rhs->len) if there is a length difference.
- * Return the result of strncpy() otherwise.
+ * Return -1 or 1 if lhs is shorter or longer than rhs.
+ * Return the result of strncmp() otherwise.
  */
 i32 string_compare(String* lhs, String* rhs) {
   if (!lhs || !rhs) {
     return 0;
   }
-  const i32 len_diff = lhs->len - rhs->len;
-
-  if (!len_diff) {
-    return strncmp(lhs->c_str, rhs->c_str, lhs->len);
-  } else {
-    return len_diff;
+  // the lengths are 64-bit, their difference does not fit the result
+  if (lhs->len != rhs->len) {
+    return lhs->len < rhs->len ? -1 : 1;
   }
+  return strncmp(lhs->c_str, rhs->c_str, lhs->len);
 }
 
 String* string_from_c_str(char* c_str, SimpleArena* arena, i32* err) {
@@ -50,8 +51,8 @@ String* string_from_c_str(char* c_str, SimpleArena* arena, i32* err) {
     return 0;
   }
 
-  u32 size_str = 0;
-  for (u32 i = 0; i < MAX_LEN_C_STR; i++) {
+  u64 size_str = 0;
+  for (u64 i = 0; i < MAX_LEN_C_STR; i++) {
     if (c_str[i] == '\0') {
       size_str = i + 1;
       break;
@@ -68,7 +69,6 @@ String* string_from_c_str(char* c_str, SimpleArena* arena, i32* err) {
     return 0;
   }
   String* string = (String*)buf;
-  string->c_str  = (char*)(buf + sizeof(String));
   string->len    = size_str - 1;
   memcpy(string->c_str, c_str, size_str);
   return string;